@@ -0,0 +1,119 @@
+#ifndef _DFA_BUILDER_H
+#define _DFA_BUILDER_H
+
+#include <nfa_builder.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Target of a missing transition: once reached the input is rejected
+#define DFA_DEAD_STATE (-1)
+
+/*
+    type definition of the DFA.
+    table holds one row of classes_len target states per state, so that
+    the transition of state s on character c is table[s * classes_len + class_map[c]].
+    Without byte classes class_map is NULL and classes_len is ASCII_LEN.
+    class_map is not owned by the DFA, it must outlive it.
+    The initial state is always state 0.
+    tags is NULL unless the DFA was built from a tagged NFA (see nfa_collection_merge),
+    in which case tags[s] is the token type accepted in the final state s.
+*/
+typedef struct _dfa{
+    size_t states_len;
+    size_t classes_len;
+    const unsigned char* class_map;
+    int* table;
+    bool* final;
+    int* tags;
+} dfa_t;
+
+/*
+    Bookkeeping of a subset construction: every DFA state stands for a set
+    of NFA states, stored as a bitset of set_words words in sets.
+    buckets is an open addressing hash table from a bitset to its DFA state.
+*/
+typedef struct _subset{
+    size_t set_words;
+    size_t sets_len;
+    size_t sets_capacity;
+    uint64_t* sets;
+    size_t buckets_len;
+    int* buckets;
+} subset_t;
+
+/*
+    Number of strings walked in lockstep by dfa_classify_batch, one per lane:
+    on x86-64 processors with AVX2 a step of all the lanes is a single gather
+    from the table, elsewhere the lanes are interleaved in a scalar loop.
+*/
+#define DFA_BATCH_LANES 8
+
+// Transition of a lazy DFA not computed yet
+#define LAZY_DFA_UNKNOWN (-2)
+// Memory budget of a lazy DFA when none is given, in bytes
+#define LAZY_DFA_DEFAULT_BUDGET ((size_t) 1 << 20)
+// Least number of states cached by a lazy DFA, whatever the budget
+#define LAZY_DFA_MIN_STATES 2
+
+/*
+    DFA built on demand while matching: the states and transitions met by the
+    input are computed from the NFA and cached, at most states_max of them as
+    allowed by the memory budget. A full cache is flushed, and a match which
+    flushes it too often finishes on the NFA instead.
+    table holds ASCII_LEN targets per cached state, LAZY_DFA_UNKNOWN if not computed.
+    walked counts the characters matched since the last flush.
+    The NFA must outlive the lazy DFA.
+*/
+typedef struct _lazy_dfa{
+    const nfa_t* nfa;
+    size_t states_max;
+    subset_t subset;
+    int* table;
+    bool* final;
+    uint64_t* sets;
+    size_t walked;
+    size_t flushes;
+    size_t fallbacks;
+} lazy_dfa_t;
+
+/*
+    Callback of dfa_search, called on every match with its offset start in the
+    buffer, its length and its tag (as given by dfa_classify).
+    Returns OK to go on, any other value stops the search, which returns it.
+*/
+typedef int (*dfa_search_callback_t)(size_t start, size_t len, int tag, void* context);
+
+// Builds the DFA equivalent to the NFA (subset construction)
+int dfa_from_nfa(dfa_t* dfa, const nfa_t* nfa);
+// Minimizes the DFA in place (Hopcroft's partition refinement)
+int dfa_minimize(dfa_t* dfa);
+// Indexes the table by byte class (see nfa_collection_classes) instead of by character
+int dfa_compress(dfa_t* dfa, const unsigned char* class_map, size_t classes_len);
+// Converts the DFA back to an equivalent (deterministic) NFA
+int dfa_to_nfa(nfa_t* nfa, const dfa_t* dfa);
+// Checks if the DFA accepts a particular string
+int dfa_accepts(const dfa_t* dfa, const char* string, bool* result);
+// Gets the tag of the state reached on the string, NFA_NO_TAG if rejected (0 if accepted by an untagged DFA)
+int dfa_classify(const dfa_t* dfa, const char* string, int* tag);
+// Gets the tag of the longest prefix of the string accepted (as dfa_classify) and its length, NFA_NO_TAG and 0 if none
+int dfa_longest_match(const dfa_t* dfa, const char* string, int* tag, size_t* len);
+// Classifies count strings at once as dfa_classify, tags[i] being the tag of strings[i] (see DFA_BATCH_LANES)
+int dfa_classify_batch(const dfa_t* dfa, const char* const* strings, size_t count, int* tags);
+// Reports the leftmost-longest matches in the len characters of buffer (NUL ones included), left to right and not overlapping, reading each character once
+int dfa_search(const dfa_t* dfa, const char* buffer, size_t len, dfa_search_callback_t callback, void* context);
+// Writes path.c and path.h, defining the DFA as the read only dfa_t name with static const tables
+int dfa_generate(const dfa_t* dfa, const char* name, const char* path);
+// Writes path.c and path.h, defining int name(const char*, size_t*) as a direct-coded dfa_longest_match: a labelled block per state
+int dfa_generate_scanner(const dfa_t* dfa, const char* name, const char* path);
+// Destroys the DFA
+void dfa_destroy(dfa_t* dfa);
+
+// Starts a lazy DFA on the NFA, caching as many states as fit in budget bytes (0 for the default)
+int lazy_dfa_init(lazy_dfa_t* dfa, const nfa_t* nfa, size_t budget);
+// Checks if the lazy DFA accepts a particular string, extending its cache as needed
+int lazy_dfa_accepts(lazy_dfa_t* dfa, const char* string, bool* result);
+// Destroys the lazy DFA
+void lazy_dfa_destroy(lazy_dfa_t* dfa);
+
+#endif
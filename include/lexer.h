@@ -5,10 +5,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/types.h>
 #ifdef _DEBUG
 #include <assert.h>
 #endif
 #include <nfa_builder.h>
+#include <dfa_builder.h>
 
 typedef enum {
 	DELIM,
@@ -39,14 +41,44 @@ typedef struct{
 
 	nfa_t* nfa_collection;
 	size_t nfa_collection_size;
+
+	// DFA of the merged collection, tagged with the token type
+	dfa_t* merged_dfa;
+	// merged_dfa is the read only DFA compiled in the library (see tokenizer_init_builtin)
+	bool builtin;
+	// direct-coded longest token of a string (see dfa_generate_scanner), used instead of merged_dfa if not NULL
+	int (*scan)(const char*, size_t*);
+	// byte classes indexing the DFA tables
+	unsigned char class_map[ASCII_LEN];
+	size_t classes_len;
+	// the automata belong to another tokenizer (see tokenizer_init_shared), which must outlive this one
+	bool shared;
 } toklist_t;
 
-/* scans a string for tokens */
-int tokenize(toklist_t*, char*);
+/* Size of the chunks read by tokenize_stream */
+#define TOKENIZER_CHUNK_LEN ((size_t) 1 << 16)
+/* Longest token tokenize_stream buffers: a token still growing past it is an INVALID_TOKEN */
+#define TOKENIZER_MAX_TOKEN_LEN ((size_t) 1 << 20)
+
+/* reads at most len bytes of source into buffer: the number of bytes read, 0 at the end of the input, -1 on error (as read) */
+typedef ssize_t (*tokenizer_read_t)(void* source, char* buffer, size_t len);
+/* receives the next token, its len characters at tk (not NUL terminated) until it returns: OK to go on, any other value stops the tokenizer, which returns it */
+typedef int (*tokenizer_consume_t)(void* context, toktype_t tt, const char* tk, size_t len);
+
+/* scans a string for tokens in a single pass, each the longest token at its position (maximal munch) */
+int tokenize(toklist_t*, const char*);
+/* scans the input pulled from read_chunk, handing the tokens to consume as they are found: each character is scanned once, the memory used depends on the longest token (see TOKENIZER_MAX_TOKEN_LEN), not on the input */
+int tokenize_stream(const toklist_t*, tokenizer_read_t read_chunk, void* source, tokenizer_consume_t consume, void* context);
+/* scans the input of the file descriptor as tokenize_stream, into the token list as tokenize */
+int tokenize_fd(toklist_t*, int fd);
 /* prints the scanned tokens */
 void print_tokens(const toklist_t*);
 /* Initializes the tokenizer (builds NFAs with hard-coded regular expressions) */
 int tokenizer_init(toklist_t* toklist, const char* nfa_collection_filename);
+/* Initializes the tokenizer on the token tables generated at build time, without reading any file */
+int tokenizer_init_builtin(toklist_t* toklist);
+/* Initializes a tokenizer with a token list of its own on the automata of source, which are only read: one tokenizer per thread can share them */
+int tokenizer_init_shared(toklist_t* toklist, const toklist_t* source);
 void tokenizer_deinit(toklist_t* toklist);
 const char* tokenizer_typetokstr(toktype_t tktype);
 
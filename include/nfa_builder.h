@@ -4,8 +4,19 @@
 #include <regexparse.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #define ASCII_LEN 128
+#define SYMBOLS_WORDS (ASCII_LEN / 64)
+
+/*
+    Version of the NFA builders, part of the key of the cached automata:
+    to be increased whenever a change to the builders changes the automata they output.
+*/
+#define NFA_BUILDER_VERSION 1
+
+// Tag of the states not accepting any token
+#define NFA_NO_TAG (-1)
 
 /* 
 state_t serves as a map between characters and states.
@@ -13,6 +24,18 @@ charset contains the string of mapped characters and
 mapped_states is the array containing the indices of the states.
 In the event of a single character leading to multiple states, 
 the character should be repeated in the charset.   
+
+nfa_compact() additionally indexes the transitions in row, a single block:
+a deterministic state stores ASCII_LEN target states (-1 for no transition),
+otherwise symbols is the bitmap of the characters with a transition and row
+holds popcount(symbols)+1 offsets followed by the targets sorted by character.
+
+nfa_compact() also sets dead on the states from which no final state can be
+reached, and leaves the transitions to them out of row: the active states of
+a match are then all live, and a match with none left can stop.
+
+A state of capacity 0 with transitions does not own charset, mapped_state
+and row: they point into the file mapping of a loaded collection.
 */
 
 typedef struct _state{
@@ -21,34 +44,128 @@ typedef struct _state{
     char* charset;
     int* mapped_state;
     bool final;
+
+    bool deterministic;
+    bool dead;
+    uint64_t symbols[SYMBOLS_WORDS];
+    int* row;
 } state_t;
 
 /*
-    type definition of the NFA
+    Bit-parallel simulation tables, built by nfa_compact() for NFAs of at most
+    NFA_PARALLEL_MAX_STATES states where every state is entered on the same
+    characters from each of its predecessors (as nfa_build produces them).
+    State sets are bitmasks of words words and a step on character c is
+    next = follow(current) & entered[c].
+    follow is tabulated for every 4 states: the successors of each of their 16 subsets.
+*/
+#define NFA_PARALLEL_MAX_STATES 512
+#define NFA_PARALLEL_MAX_WORDS (NFA_PARALLEL_MAX_STATES / 64)
+
+typedef struct _nfa_parallel{
+    size_t words;
+    uint64_t* entered;
+    uint64_t* follow;
+    uint64_t* final;
+} nfa_parallel_t;
+
+/*
+    type definition of the NFA.
+    tags is NULL unless the NFA recognizes several patterns (see nfa_collection_merge):
+    then tags[s] is the pattern accepted in state s, NFA_NO_TAG if s is not final.
+    Matching never writes to the NFA: the active states belong to a match_t,
+    so once built and compacted a NFA can be shared by threads, each matching
+    with a match_t of its own.
+    A NFA loaded from a collection file is read only, its transitions and tags
+    are used in place from the file mapped in memory. mapping is that mapping,
+    held by the merged NFA and by the first NFA of a collection, NULL otherwise.
 */
 typedef struct _nfa{
     size_t states_len;
-    size_t current_states_len;
-    size_t current_states_capacity;
     state_t* states;
-    int* current_states;
+    nfa_parallel_t* parallel;
+    int* tags;
+    void* mapping;
+    size_t mapping_len;
 } nfa_t;
 
+/*
+    Incremental match of a NFA, fed one character at a time.
+    A match owns its state sets, so any number of matches can run on the same NFA.
+    The active states are kept in a sparse set: states and next_states list the
+    states of the current and of the next step, sparse_states maps a state to
+    its position in next_states.
+    states_len is the number of active states (with the bit-parallel tables,
+    parallel_states holds them and states_len is just 0 once none is left).
+*/
+typedef struct _match{
+    const nfa_t* nfa;
+    size_t states_len;
+    int* states;
+    int* next_states;
+    int* sparse_states;
+    uint64_t parallel_states[NFA_PARALLEL_MAX_WORDS];
+} match_t;
+
 // Builds the NFA corresponding to the passed parse-tree.
 int nfa_build(nfa_t* nfa, const node_t* _parse_tree);
+// Builds the position automaton of the parse-tree in a single traversal (same language as nfa_build)
+int nfa_build_glushkov(nfa_t* nfa, const node_t* parse_tree);
 // Save a NFA collection to disk
 int nfa_collection_save(const nfa_t* nfa_collection, size_t count, const char* filename);
-// Load NFA collection from disk into nfa, its length into len
+// Load NFA collection from disk into nfa, its length into len (the file is mapped in memory, see nfa_t)
 int nfa_collection_load(nfa_t** nfa, size_t* len, const char* filename);
+// Load the merged NFA saved with a NFA collection
+int nfa_collection_load_merged(nfa_t* merged, const char* filename);
+// Load a NFA collection, its merged NFA and its byte classes from a single mapping of the file:
+// merged reads the mapping held by the collection, it is destroyed with nfa_destroy before nfa_collection_delete
+int nfa_collection_open(nfa_t** nfa, size_t* len, nfa_t* merged, unsigned char* class_map, size_t* classes_len, const char* filename);
+// Key of the automaton compiled from regex with the given builder options (see NFA_BUILDER_VERSION)
+uint64_t nfa_cache_key(const char* regex, uint32_t options);
+// Loads the automaton cached in directory under key, read only as the ones of nfa_collection_load (IO_ERROR if not cached)
+int nfa_cache_load(nfa_t* nfa, const char* directory, uint64_t key);
+// Caches the automaton in directory, created if needed, as the file named by key in 16 hex digits followed by ".dat"
+int nfa_cache_store(const nfa_t* nfa, const char* directory, uint64_t key);
+// Builds the union of a NFA collection, tagging the final states with the index of the first NFA accepting there
+int nfa_collection_merge(nfa_t* merged, const nfa_t* nfa_collection, size_t count);
+// Computes the byte equivalence classes of a NFA collection: class_map maps ASCII_LEN bytes to classes_len classes
+int nfa_collection_classes(const nfa_t* nfa_collection, size_t count, unsigned char* class_map, size_t* classes_len);
 // Destroys the NFA
 void nfa_destroy(nfa_t* nfa);
-// Checks if the NFA accepts a particular string
-int nfa_accepts(nfa_t* nfa, const char* string, bool* result);
+// Checks if the NFA accepts a particular string (with a match of its own, see match_accepts to reuse one)
+int nfa_accepts(const nfa_t* nfa, const char* string, bool* result);
+// Checks count strings at once, results[i] telling if strings[i] is accepted (a single match for all of them)
+int nfa_accepts_batch(const nfa_t* nfa, const char* const* strings, size_t count, bool* results);
+// Builds the dense transition index of every state, and the bit-parallel tables if the NFA allows them
+int nfa_compact(nfa_t* nfa);
+// Removes the states not reachable from the initial state or not reaching a final state (the NFA must be compacted again)
+int nfa_trim(nfa_t* nfa);
+// Merges the states equivalent by forward or backward bisimulation and drops repeated transitions (the NFA must be compacted again)
+int nfa_reduce(nfa_t* nfa);
+// Renumbers the states breadth-first from the initial state, or by decreasing visits (see nfa_profile) if not NULL (the NFA must be compacted again)
+int nfa_layout(nfa_t* nfa, const size_t* visits);
+// Adds to visits[s] the steps in which state s is active while matching the strings (visits has states_len entries)
+int nfa_profile(const nfa_t* nfa, const char* const* strings, size_t count, size_t* visits);
+
+// Starts a match of the NFA from its initial state
+int match_begin(match_t* match, const nfa_t* nfa);
+// Restarts the match from the initial state
+void match_reset(match_t* match);
+// Advances the match by one character
+void match_feed(match_t* match, char c);
+// Checks if the characters fed so far are accepted
+bool match_is_accepting(const match_t* match);
+// Checks if no state is left, so that no further character can lead to acceptance
+bool match_is_dead(const match_t* match);
+// Restarts the match and checks if the NFA accepts the whole string
+int match_accepts(match_t* match, const char* string, bool* result);
+// Releases the state sets of the match
+void match_end(match_t* match);
 
 /* DEBUG */
 // Prints the NFA in graphviz format to stdout
 int nfa_graph(const nfa_t* nfa);
-// Compares 2 NFA and prints first found difference
+// Compares 2 NFA and prints their sizes and first found difference
 void nfa_compare(const nfa_t* restrict nfa1, const nfa_t* restrict nfa2);
 /* *** */
 
@@ -5,23 +5,46 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 
 typedef enum __op{
 	NONE,
 	CONCAT,
 	UNION,
-	STAR
+	STAR,
+	SET
 } op_t;
 
+/*
+	A SET node is a leaf matching any character of set:
+	character c is in the set if bit c % 64 of set[c / 64] is 1.
+	It is written as [...], with ranges a-z and a leading ^ for the complement.
+*/
 typedef struct __node{
 	op_t op;
 	char c;
+	uint64_t set[2];
 	struct __node* l_child;
 	struct __node* r_child;
+	struct __tree_arena* arena;
 } node_t;
 
+/*
+	The nodes of a tree are allocated in a single arena, sized by tree_parse
+	from the length of the expression: tree_deinit frees them all at once.
+	Every node points to the arena of its tree.
+*/
+typedef struct __tree_arena{
+	size_t len;
+	size_t capacity;
+	node_t nodes[];
+} tree_arena_t;
+
 int tree_parse(node_t** node, const char* str);
+/* folds unions of characters into SET nodes and flattens nested chains, to be run before nfa_build */
+int tree_optimize(node_t** node);
+/* frees the whole tree the node belongs to */
 void tree_deinit(node_t**);
 int tree_graph(node_t*);
 
@@ -0,0 +1,2048 @@
+#include <dfa_builder.h>
+#include <compiler_errors.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _DEBUG
+#include <assert.h>
+#endif
+
+// the AVX2 kernel of dfa_classify_batch is compiled apart and chosen at run time
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define DFA_BATCH_AVX2
+_Static_assert(DFA_BATCH_LANES == 8, "a lane per 32 bit element of an AVX2 register");
+#endif
+
+#define SUBSET_WORD_BITS 64
+
+// A lazy DFA whose cache fills before this many characters per state falls back to the NFA
+#define LAZY_DFA_MIN_CHARS_PER_STATE 10
+
+// Longest literal prefix looked for by the prefilter of dfa_search
+#define PREFILTER_MAX_PREFIX 16
+
+// Level of a DFA state no thread of dfa_search is in
+#define SEARCH_NO_THREAD SIZE_MAX
+
+/*
+    Prefilter of a search, telling where a match can start: first[c] if a match
+    can start with character c, and every match starts with the literal prefix.
+    A nullable DFA matches the empty string anywhere, so it has no prefilter.
+*/
+typedef struct _prefilter{
+    bool nullable;
+    size_t first_len;
+    bool first[ASCII_LEN];
+    size_t prefix_len;
+    char prefix[PREFILTER_MAX_PREFIX];
+} prefilter_t;
+
+/*
+    A level of dfa_search: the search for a match starting from floor on, and
+    the leftmost-longest match it found so far (if matched). Every level but
+    the last has found one, the next level searching from its end.
+    threads is the number of threads walking for the level.
+*/
+typedef struct _search_level{
+    size_t floor;
+    bool matched;
+    size_t start;
+    size_t end;
+    int tag;
+    size_t threads;
+} search_level_t;
+
+/*
+    State of dfa_search: at most one thread per DFA state, walking for level[s]
+    since position start[s] (SEARCH_NO_THREAD if none), listed in states.
+    Two threads in the same state walk the same way, so the one of the lower
+    level, or else the one starting first, is kept.
+    The levels [head, tail) are waiting for the threads of the levels before them.
+*/
+typedef struct _search{
+    const dfa_t* dfa;
+    size_t* level;
+    size_t* start;
+    size_t* next_level;
+    size_t* next_start;
+    int* states;
+    int* next_states;
+    size_t states_len;
+    search_level_t* levels;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+} search_t;
+
+/*
+    Partition of the states refined by the minimization. The states of block b
+    are contiguous in elements, in the range [first[b], end[b]), and the first
+    marked[b] of them are the ones marked to be split off.
+    location is the inverse of elements, block maps a state to its block.
+*/
+typedef struct _partition{
+    size_t blocks_len;
+    size_t* elements;
+    size_t* location;
+    size_t* block;
+    size_t* first;
+    size_t* end;
+    size_t* marked;
+} partition_t;
+
+static int subset_init(subset_t*, size_t, size_t);
+static void subset_clear(subset_t*);
+static void subset_deinit(subset_t*);
+static int subset_lookup(subset_t*, const uint64_t*, int*);
+static int subset_find(const subset_t*, const uint64_t*);
+static int subset_rehash(subset_t*);
+static size_t subset_hash(const uint64_t*, size_t);
+static bool subset_empty(const uint64_t*, size_t);
+static int dfa_reserve(dfa_t*, size_t*, size_t, bool);
+static int dfa_walk(const dfa_t*, const char*);
+static void dfa_batch_scalar(const dfa_t*, const int*, const char* const*, int*);
+#ifdef DFA_BATCH_AVX2
+static void dfa_batch_avx2(const dfa_t*, const int*, const char* const*, int*);
+#endif
+static void prefilter_init(prefilter_t*, const dfa_t*);
+static bool prefilter_next(const prefilter_t*, const char*, size_t, size_t*);
+static int search_init(search_t*, const dfa_t*);
+static void search_deinit(search_t*);
+static int search_push(search_t*, size_t);
+static void search_insert(search_t*, int, size_t, size_t);
+static void search_step(search_t*, unsigned char);
+static int search_match(search_t*, size_t, size_t, size_t, int);
+static int search_finals(search_t*, size_t);
+static int search_report(search_t*, dfa_search_callback_t, void*, bool);
+static int dfa_generate_header(const char*, const char*, const char*);
+static FILE* dfa_generate_source(const char*);
+static void dfa_generate_ints(FILE*, const int*, size_t);
+static int lazy_dfa_state(lazy_dfa_t*, int, unsigned char, int*);
+static int lazy_dfa_add(lazy_dfa_t*, const uint64_t*);
+static int lazy_dfa_flush(lazy_dfa_t*);
+static int lazy_dfa_fallback(const lazy_dfa_t*, const char*, bool*);
+static size_t dfa_target(const dfa_t*, size_t, size_t);
+static inline size_t dfa_column(const dfa_t*, size_t);
+static inline int dfa_next(const dfa_t*, size_t, size_t);
+static void partition_mark(partition_t*, size_t, size_t*, size_t*);
+static size_t partition_split(partition_t*, size_t);
+
+/*** EXPORTED ***/
+
+int dfa_from_nfa(dfa_t* dfa, const nfa_t* nfa)
+{
+    #ifdef _DEBUG
+    assert(dfa != NULL);
+    assert(nfa != NULL);
+    assert(nfa->states_len > 0);
+    #endif
+
+    subset_t subset;
+    ERROR_RETHROW(subset_init(&subset, nfa->states_len, 8));
+
+    size_t words = subset.set_words;
+
+    // successor set of the current DFA state for every character
+    uint64_t* next;
+    if ((next = malloc(sizeof(uint64_t) * words * ASCII_LEN)) == NULL)
+    {
+        subset_deinit(&subset);
+        return BAD_ALLOCATION;
+    }
+
+    dfa_t temp = {0};
+    size_t capacity = 0;
+    temp.classes_len = ASCII_LEN;
+
+    // INITIAL STATE: the set containing only the initial NFA state
+    int index;
+    memset(next, 0, sizeof(uint64_t) * words);
+    next[0] = 1;
+    ERROR_RETHROW(
+        subset_lookup(&subset, next, &index),
+        free(next); subset_deinit(&subset)
+    );
+
+    size_t d;
+    for (d=0; d<subset.sets_len; ++d)
+    {
+        ERROR_RETHROW(
+            dfa_reserve(&temp, &capacity, d + 1, nfa->tags != NULL),
+            free(next); subset_deinit(&subset); dfa_destroy(&temp)
+        );
+
+        memset(next, 0, sizeof(uint64_t) * words * ASCII_LEN);
+        temp.final[d] = false;
+        if (temp.tags != NULL)
+        {
+            temp.tags[d] = NFA_NO_TAG;
+        }
+
+        // COLLECT THE SUCCESSORS OF EVERY NFA STATE IN THE SET, GROUPED BY CHARACTER
+        size_t w;
+        for (w=0; w<words; ++w)
+        {
+            uint64_t bits = subset.sets[d * words + w];
+            while (bits != 0)
+            {
+                size_t s = w * SUBSET_WORD_BITS + (size_t) __builtin_ctzll(bits);
+                bits &= bits - 1;
+
+                const state_t* state = &nfa->states[s];
+                if (state->final)
+                {
+                    temp.final[d] = true;
+
+                    // the lowest tag has the priority
+                    if (temp.tags != NULL && (temp.tags[d] == NFA_NO_TAG || nfa->tags[s] < temp.tags[d]))
+                    {
+                        temp.tags[d] = nfa->tags[s];
+                    }
+                }
+
+                size_t j;
+                for (j=0; j<state->len; ++j)
+                {
+                    unsigned char c = (unsigned char) state->charset[j];
+                    size_t t = (size_t) state->mapped_state[j];
+
+                    if (c >= ASCII_LEN)
+                    {
+                        continue;
+                    }
+
+                    next[c * words + t / SUBSET_WORD_BITS] |= (uint64_t) 1 << (t % SUBSET_WORD_BITS);
+                }
+            }
+        }
+
+        // MAP EVERY NON EMPTY SUCCESSOR SET TO ITS DFA STATE
+        size_t c;
+        for (c=0; c<ASCII_LEN; ++c)
+        {
+            if (subset_empty(&next[c * words], words))
+            {
+                temp.table[d * temp.classes_len + c] = DFA_DEAD_STATE;
+                continue;
+            }
+
+            ERROR_RETHROW(
+                subset_lookup(&subset, &next[c * words], &index),
+                free(next); subset_deinit(&subset); dfa_destroy(&temp)
+            );
+
+            temp.table[d * temp.classes_len + c] = index;
+        }
+    }
+
+    temp.states_len = subset.sets_len;
+
+    free(next);
+    subset_deinit(&subset);
+
+    *dfa = temp;
+    return OK;
+}
+
+int dfa_minimize(dfa_t* dfa)
+{
+    #ifdef _DEBUG
+    assert(dfa != NULL);
+    assert(dfa->states_len > 0);
+    #endif
+
+    // the missing transitions lead to an explicit dead state, the last one
+    size_t n = dfa->states_len + 1;
+    size_t symbols = dfa->classes_len;
+    size_t dead = dfa->states_len;
+    size_t edges = n * symbols;
+
+    size_t* workspace;
+    if ((workspace = malloc(sizeof(size_t) * (10 * n + 2 * edges + 1))) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+
+    partition_t partition;
+    partition.elements = workspace;
+    partition.location = partition.elements + n;
+    partition.block = partition.location + n;
+    partition.first = partition.block + n;
+    partition.end = partition.first + n;
+    partition.marked = partition.end + n;
+
+    size_t* pending = partition.marked + n;     // blocks still to be used as splitters
+    size_t* in_pending = pending + n;
+    size_t* splitter = in_pending + n;
+    size_t* touched = splitter + n;             // blocks with marked states
+    size_t* inverse_first = touched + n;       // inverse transitions, indexed by target * symbols + c
+    size_t* inverse = inverse_first + edges + 1;
+
+    // INVERSE TRANSITIONS
+    memset(inverse_first, 0, sizeof(size_t) * (edges + 1));
+
+    size_t s, c;
+    for (s=0; s<n; ++s)
+    {
+        for (c=0; c<symbols; ++c)
+        {
+            ++inverse_first[dfa_target(dfa, s, c) * symbols + c + 1];
+        }
+    }
+
+    size_t i;
+    for (i=1; i<=edges; ++i)
+    {
+        inverse_first[i] += inverse_first[i-1];
+    }
+
+    for (s=0; s<n; ++s)
+    {
+        for (c=0; c<symbols; ++c)
+        {
+            inverse[inverse_first[dfa_target(dfa, s, c) * symbols + c]++] = s;
+        }
+    }
+
+    // filling moved every start to the next one, shift them back
+    for (i=edges; i>0; --i)
+    {
+        inverse_first[i] = inverse_first[i-1];
+    }
+    inverse_first[0] = 0;
+
+    // INITIAL PARTITION: ONE BLOCK FOR THE NON FINAL STATES, ONE FOR EVERY TAG OF THE FINAL ONES
+    size_t* block_key = touched;    // unused until the refinement
+    partition.blocks_len = 0;
+
+    size_t b;
+    for (s=0; s<n; ++s)
+    {
+        size_t key = (s == dead || !dfa->final[s]) ? 0 : 1 + (size_t) ((dfa->tags != NULL) ? dfa->tags[s] : 0);
+
+        for (b=0; b<partition.blocks_len && block_key[b] != key; ++b);
+
+        if (b == partition.blocks_len)
+        {
+            block_key[b] = key;
+            partition.end[b] = 0;
+            ++partition.blocks_len;
+        }
+
+        // end holds the size of the block for now
+        partition.block[s] = b;
+        ++partition.end[b];
+        in_pending[s] = false;
+    }
+
+    size_t largest = 0;
+    for (b=1; b<partition.blocks_len; ++b)
+    {
+        if (partition.end[b] > partition.end[largest])
+        {
+            largest = b;
+        }
+    }
+
+    size_t position = 0;
+    for (b=0; b<partition.blocks_len; ++b)
+    {
+        size_t size = partition.end[b];
+        partition.first[b] = position;
+        partition.end[b] = position;
+        partition.marked[b] = 0;
+        position += size;
+    }
+
+    for (s=0; s<n; ++s)
+    {
+        position = partition.end[partition.block[s]]++;
+        partition.elements[position] = s;
+        partition.location[s] = position;
+    }
+
+    // every block but the largest one splits the others
+    size_t pending_len = 0;
+    for (b=0; b<partition.blocks_len; ++b)
+    {
+        if (b != largest)
+        {
+            pending[pending_len++] = b;
+            in_pending[b] = true;
+        }
+    }
+
+    // REFINEMENT
+    while (pending_len > 0)
+    {
+        size_t a = pending[--pending_len];
+        in_pending[a] = false;
+
+        // the block may be split while in use, keep a copy of its states
+        size_t splitter_len = partition.end[a] - partition.first[a];
+        memcpy(splitter, &partition.elements[partition.first[a]], sizeof(size_t) * splitter_len);
+
+        for (c=0; c<symbols; ++c)
+        {
+            size_t touched_len = 0;
+
+            size_t j;
+            for (j=0; j<splitter_len; ++j)
+            {
+                size_t t = splitter[j] * symbols + c;
+
+                size_t k;
+                for (k=inverse_first[t]; k<inverse_first[t+1]; ++k)
+                {
+                    partition_mark(&partition, inverse[k], touched, &touched_len);
+                }
+            }
+
+            for (j=0; j<touched_len; ++j)
+            {
+                size_t b = touched[j];
+                size_t nb = partition_split(&partition, b);
+
+                if (nb == b)
+                {
+                    continue;
+                }
+
+                if (in_pending[b])
+                {
+                    pending[pending_len++] = nb;
+                    in_pending[nb] = true;
+                }
+                else
+                {
+                    size_t smaller = (partition.end[nb] - partition.first[nb] <= partition.end[b] - partition.first[b]) ? nb : b;
+                    pending[pending_len++] = smaller;
+                    in_pending[smaller] = true;
+                }
+            }
+        }
+    }
+
+    // RENUMBER THE BLOCKS, KEEPING THE INITIAL STATE FIRST AND DROPPING THE DEAD BLOCK
+    size_t dead_block = partition.block[dead];
+    size_t* renumber = pending;
+    for (i=0; i<partition.blocks_len; ++i)
+    {
+        renumber[i] = (size_t) DFA_DEAD_STATE;
+    }
+
+    size_t states_len = 0;
+    for (s=0; s<dfa->states_len; ++s)
+    {
+        size_t b = partition.block[s];
+        if (b != dead_block && renumber[b] == (size_t) DFA_DEAD_STATE)
+        {
+            renumber[b] = states_len++;
+        }
+    }
+
+    dfa_t temp = {0};
+    size_t capacity = 0;
+    temp.classes_len = symbols;
+    temp.class_map = dfa->class_map;
+    ERROR_RETHROW(
+        dfa_reserve(&temp, &capacity, (states_len > 0) ? states_len : 1, dfa->tags != NULL),
+        free(workspace); dfa_destroy(&temp)
+    );
+
+    if (states_len == 0)
+    {
+        // the initial state is dead: the empty language
+        temp.final[0] = false;
+        if (temp.tags != NULL)
+        {
+            temp.tags[0] = NFA_NO_TAG;
+        }
+
+        for (c=0; c<symbols; ++c)
+        {
+            temp.table[c] = DFA_DEAD_STATE;
+        }
+        states_len = 1;
+    }
+
+    for (i=0; i<partition.blocks_len; ++i)
+    {
+        if (i == dead_block)
+        {
+            continue;
+        }
+
+        size_t d = renumber[i];
+        size_t representative = partition.elements[partition.first[i]];
+
+        temp.final[d] = dfa->final[representative];
+        if (temp.tags != NULL)
+        {
+            temp.tags[d] = dfa->tags[representative];
+        }
+
+        for (c=0; c<symbols; ++c)
+        {
+            size_t b = partition.block[dfa_target(dfa, representative, c)];
+            temp.table[d * symbols + c] = (b == dead_block) ? DFA_DEAD_STATE : (int) renumber[b];
+        }
+    }
+
+    temp.states_len = states_len;
+
+    free(workspace);
+    dfa_destroy(dfa);
+
+    *dfa = temp;
+    return OK;
+}
+
+int dfa_compress(dfa_t* dfa, const unsigned char* class_map, size_t classes_len)
+{
+    #ifdef _DEBUG
+    assert(dfa != NULL);
+    assert(dfa->class_map == NULL);
+    assert(class_map != NULL);
+    assert(classes_len > 0 && classes_len <= ASCII_LEN);
+    #endif
+
+    int* table;
+    if ((table = malloc(sizeof(int) * dfa->states_len * classes_len)) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+
+    // every character of a class has the same transitions, any of them stands for the class
+    size_t s, c;
+    for (s=0; s<dfa->states_len; ++s)
+    {
+        for (c=0; c<ASCII_LEN; ++c)
+        {
+            #ifdef _DEBUG
+            assert(class_map[c] < classes_len);
+            #endif
+
+            table[s * classes_len + class_map[c]] = dfa->table[s * ASCII_LEN + c];
+        }
+    }
+
+    #ifdef _DEBUG
+    for (s=0; s<dfa->states_len; ++s)
+    {
+        for (c=0; c<ASCII_LEN; ++c)
+        {
+            assert(table[s * classes_len + class_map[c]] == dfa->table[s * ASCII_LEN + c]);
+        }
+    }
+    #endif
+
+    free(dfa->table);
+    dfa->table = table;
+    dfa->class_map = class_map;
+    dfa->classes_len = classes_len;
+    return OK;
+}
+
+int dfa_to_nfa(nfa_t* nfa, const dfa_t* dfa)
+{
+    #ifdef _DEBUG
+    assert(nfa != NULL);
+    assert(dfa != NULL);
+    #endif
+
+    nfa_t temp = {0};
+    if ((temp.states = calloc(dfa->states_len, sizeof(state_t))) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+    temp.states_len = dfa->states_len;
+
+    if (dfa->tags != NULL)
+    {
+        if ((temp.tags = malloc(sizeof(int) * dfa->states_len)) == NULL)
+        {
+            nfa_destroy(&temp);
+            return BAD_ALLOCATION;
+        }
+
+        memcpy(temp.tags, dfa->tags, sizeof(int) * dfa->states_len);
+    }
+
+    size_t s;
+    for (s=0; s<dfa->states_len; ++s)
+    {
+        state_t* state = &temp.states[s];
+        state->final = dfa->final[s];
+
+        const int* row = &dfa->table[s * dfa->classes_len];
+
+        size_t c, len = 0;
+        for (c=0; c<ASCII_LEN; ++c)
+        {
+            len += (row[dfa_column(dfa, c)] != DFA_DEAD_STATE);
+        }
+
+        if (len == 0)
+        {
+            continue;
+        }
+
+        if ((state->charset = malloc(sizeof(char) * len)) == NULL)
+        {
+            nfa_destroy(&temp);
+            return BAD_ALLOCATION;
+        }
+
+        if ((state->mapped_state = malloc(sizeof(int) * len)) == NULL)
+        {
+            free(state->charset);
+            state->charset = NULL;
+            nfa_destroy(&temp);
+            return BAD_ALLOCATION;
+        }
+
+        state->capacity = len;
+        for (c=0; c<ASCII_LEN; ++c)
+        {
+            if (row[dfa_column(dfa, c)] != DFA_DEAD_STATE)
+            {
+                state->charset[state->len] = (char) c;
+                state->mapped_state[state->len] = row[dfa_column(dfa, c)];
+                ++state->len;
+            }
+        }
+    }
+
+    *nfa = temp;
+    return OK;
+}
+
+int dfa_accepts(const dfa_t* dfa, const char* string, bool* result)
+{
+    #ifdef _DEBUG
+    assert(dfa != NULL);
+    assert(string != NULL);
+    #endif
+
+    int state = dfa_walk(dfa, string);
+    *result = (state != DFA_DEAD_STATE) && dfa->final[state];
+    return OK;
+}
+
+int dfa_classify(const dfa_t* dfa, const char* string, int* tag)
+{
+    #ifdef _DEBUG
+    assert(dfa != NULL);
+    assert(string != NULL);
+    #endif
+
+    *tag = NFA_NO_TAG;
+
+    int state = dfa_walk(dfa, string);
+    if (state != DFA_DEAD_STATE && dfa->final[state])
+    {
+        // untagged DFAs have a single class of accepted strings
+        *tag = (dfa->tags != NULL) ? dfa->tags[state] : 0;
+    }
+
+    return OK;
+}
+
+int dfa_longest_match(const dfa_t* dfa, const char* string, int* tag, size_t* len)
+{
+    #ifdef _DEBUG
+    assert(dfa != NULL);
+    assert(string != NULL);
+    #endif
+
+    *tag = NFA_NO_TAG;
+    *len = 0;
+
+    int state = 0;
+    size_t i;
+    for (i=0; ; ++i)
+    {
+        if (dfa->final[state])
+        {
+            // untagged DFAs have a single class of accepted strings
+            *tag = (dfa->tags != NULL) ? dfa->tags[state] : 0;
+            *len = i;
+        }
+
+        unsigned char c = (unsigned char) string[i];
+        if (c == '\0' || c >= ASCII_LEN || (state = dfa_next(dfa, (size_t) state, c)) == DFA_DEAD_STATE)
+        {
+            return OK;
+        }
+    }
+}
+
+int dfa_classify_batch(const dfa_t* dfa, const char* const* strings, size_t count, int* tags)
+{
+    #ifdef _DEBUG
+    assert(dfa != NULL);
+    assert(strings != NULL || count == 0);
+    assert(tags != NULL || count == 0);
+    #endif
+
+    // column of every character, so that the lanes index the table with ints only
+    int columns[ASCII_LEN];
+    size_t c;
+    for (c=0; c<ASCII_LEN; ++c)
+    {
+        columns[c] = (int) dfa_column(dfa, c);
+    }
+
+    void (*batch)(const dfa_t*, const int*, const char* const*, int*) = dfa_batch_scalar;
+
+    #ifdef DFA_BATCH_AVX2
+    // the gather indexes the table with 32 bit offsets
+    if (dfa->states_len * dfa->classes_len <= INT32_MAX && __builtin_cpu_supports("avx2"))
+    {
+        batch = dfa_batch_avx2;
+    }
+    #endif
+
+    size_t i;
+    for (i=0; i + DFA_BATCH_LANES <= count; i += DFA_BATCH_LANES)
+    {
+        int states[DFA_BATCH_LANES];
+        batch(dfa, columns, &strings[i], states);
+
+        size_t lane;
+        for (lane=0; lane<DFA_BATCH_LANES; ++lane)
+        {
+            int state = states[lane];
+            tags[i + lane] = NFA_NO_TAG;
+
+            if (state != DFA_DEAD_STATE && dfa->final[state])
+            {
+                tags[i + lane] = (dfa->tags != NULL) ? dfa->tags[state] : 0;
+            }
+        }
+    }
+
+    // the last strings, too few to fill the lanes
+    for (; i<count; ++i)
+    {
+        ERROR_RETHROW(dfa_classify(dfa, strings[i], &tags[i]));
+    }
+
+    return OK;
+}
+
+int dfa_search(const dfa_t* dfa, const char* buffer, size_t len, dfa_search_callback_t callback, void* context)
+{
+    #ifdef _DEBUG
+    assert(dfa != NULL);
+    assert(buffer != NULL || len == 0);
+    assert(callback != NULL);
+    #endif
+
+    prefilter_t prefilter;
+    prefilter_init(&prefilter, dfa);
+
+    search_t search;
+    ERROR_RETHROW(search_init(&search, dfa));
+
+    // A SINGLE PASS: EVERY CHARACTER MOVES EACH THREAD ONCE, NONE IS READ AGAIN
+    size_t i = 0;
+    for (;;)
+    {
+        search_level_t* last = &search.levels[search.tail - 1];
+
+        // without threads the prefilter skips to the next position a match can start at
+        if (search.states_len == 0 && search.tail - search.head == 1)
+        {
+            i = (i > last->floor) ? i : last->floor;
+            if (!prefilter_next(&prefilter, buffer, len, &i))
+            {
+                break;
+            }
+        }
+
+        unsigned char c = (i < len) ? (unsigned char) buffer[i] : '\0';
+        if (i >= last->floor && (prefilter.nullable || (i < len && c < ASCII_LEN && prefilter.first[c])))
+        {
+            search_insert(&search, 0, search.tail - 1, i);
+
+            // the empty match at i counts even if an earlier thread took the initial state
+            if (dfa->final[0])
+            {
+                ERROR_RETHROW(
+                    search_match(&search, search.tail - 1, i, i, (dfa->tags != NULL) ? dfa->tags[0] : 0),
+                    search_deinit(&search)
+                );
+            }
+        }
+
+        ERROR_RETHROW(search_report(&search, callback, context, false), search_deinit(&search));
+
+        if (i == len)
+        {
+            break;
+        }
+
+        search_step(&search, c);
+        ++i;
+
+        ERROR_RETHROW(search_finals(&search, i), search_deinit(&search));
+        ERROR_RETHROW(search_report(&search, callback, context, false), search_deinit(&search));
+    }
+
+    // at the end of the buffer no match can grow: they are all settled
+    ERROR_RETHROW(search_report(&search, callback, context, true), search_deinit(&search));
+
+    search_deinit(&search);
+    return OK;
+}
+
+int dfa_generate(const dfa_t* dfa, const char* name, const char* path)
+{
+    #ifdef _DEBUG
+    assert(dfa != NULL);
+    assert(name != NULL);
+    assert(path != NULL);
+    #endif
+
+    char declaration[strlen(name) + 64];
+    snprintf(declaration, sizeof(declaration), "// read only: the tables are static const\nextern const dfa_t %s;", name);
+    ERROR_RETHROW(dfa_generate_header(path, name, declaration));
+
+    FILE* file;
+    if ((file = dfa_generate_source(path)) == NULL)
+    {
+        return IO_ERROR;
+    }
+
+    size_t i;
+    if (dfa->class_map != NULL)
+    {
+        fprintf(file, "\nstatic const unsigned char %s_class_map[%d] = {", name, ASCII_LEN);
+        for (i=0; i<ASCII_LEN; ++i)
+        {
+            fprintf(file, "%s%u,", (i % 16 == 0) ? "\n    " : " ", dfa->class_map[i]);
+        }
+        fprintf(file, "\n};\n");
+    }
+
+    fprintf(file, "\nstatic const int %s_table[%lu] = {", name, dfa->states_len * dfa->classes_len);
+    dfa_generate_ints(file, dfa->table, dfa->states_len * dfa->classes_len);
+
+    fprintf(file, "\nstatic const bool %s_final[%lu] = {", name, dfa->states_len);
+    for (i=0; i<dfa->states_len; ++i)
+    {
+        fprintf(file, "%s%d,", (i % 16 == 0) ? "\n    " : " ", dfa->final[i]);
+    }
+    fprintf(file, "\n};\n");
+
+    if (dfa->tags != NULL)
+    {
+        fprintf(file, "\nstatic const int %s_tags[%lu] = {", name, dfa->states_len);
+        dfa_generate_ints(file, dfa->tags, dfa->states_len);
+    }
+
+    fprintf(file, "\nconst dfa_t %s = {\n", name);
+    fprintf(file, "    .states_len = %lu,\n", dfa->states_len);
+    fprintf(file, "    .classes_len = %lu,\n", dfa->classes_len);
+
+    if (dfa->class_map != NULL)
+    {
+        fprintf(file, "    .class_map = %s_class_map,\n", name);
+    }
+    else
+    {
+        fprintf(file, "    .class_map = NULL,\n");
+    }
+
+    fprintf(file, "    .table = (int*) %s_table,\n", name);
+    fprintf(file, "    .final = (bool*) %s_final,\n", name);
+
+    if (dfa->tags != NULL)
+    {
+        fprintf(file, "    .tags = (int*) %s_tags,\n", name);
+    }
+    else
+    {
+        fprintf(file, "    .tags = NULL,\n");
+    }
+
+    fprintf(file, "};\n");
+
+    if (ferror(file) || fclose(file) != 0)
+    {
+        return IO_ERROR;
+    }
+
+    return OK;
+}
+
+int dfa_generate_scanner(const dfa_t* dfa, const char* name, const char* path)
+{
+    #ifdef _DEBUG
+    assert(dfa != NULL);
+    assert(name != NULL);
+    assert(path != NULL);
+    #endif
+
+    char declaration[strlen(name) + 256];
+    snprintf(declaration, sizeof(declaration), "// Tag of the longest token the string starts with and its length in len, NFA_NO_TAG if none (as dfa_longest_match)\nint %s(const char* string, size_t* len);", name);
+    ERROR_RETHROW(dfa_generate_header(path, name, declaration));
+
+    // only the states with a predecessor get a label
+    bool* entered;
+    if ((entered = calloc(dfa->states_len, sizeof(bool))) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+
+    size_t s, c;
+    for (s=0; s<dfa->states_len; ++s)
+    {
+        for (c=1; c<ASCII_LEN; ++c)
+        {
+            int t = dfa_next(dfa, s, c);
+            if (t != DFA_DEAD_STATE)
+            {
+                entered[t] = true;
+            }
+        }
+    }
+
+    FILE* file;
+    if ((file = dfa_generate_source(path)) == NULL)
+    {
+        free(entered);
+        return IO_ERROR;
+    }
+
+    fprintf(file, "\nint %s(const char* string, size_t* len)\n{\n", name);
+    fprintf(file, "    const unsigned char* p = (const unsigned char*) string;\n");
+    fprintf(file, "    const unsigned char* end = p;\n");
+    fprintf(file, "    int tag = NFA_NO_TAG;\n");
+
+    // A BLOCK PER STATE, A SWITCH ON THE NEXT CHARACTER: A FINAL STATE RECORDS THE TOKEN, A MISSING TRANSITION ENDS IT
+    for (s=0; s<dfa->states_len; ++s)
+    {
+        if (entered[s])
+        {
+            fprintf(file, "\nstate_%lu:\n", s);
+        }
+        else
+        {
+            fprintf(file, "\n");
+        }
+
+        if (dfa->final[s])
+        {
+            fprintf(file, "    tag = %d;\n    end = p;\n", (dfa->tags != NULL) ? dfa->tags[s] : 0);
+        }
+
+        fprintf(file, "    switch (*p++)\n    {\n");
+
+        // the characters leading to the same state share a case list
+        bool done[ASCII_LEN] = {false};
+        for (c=1; c<ASCII_LEN; ++c)
+        {
+            int t = dfa_next(dfa, s, c);
+            if (done[c] || t == DFA_DEAD_STATE)
+            {
+                continue;
+            }
+
+            fprintf(file, "       ");
+
+            size_t d, cases = 0;
+            for (d=c; d<ASCII_LEN; ++d)
+            {
+                if (!done[d] && dfa_next(dfa, s, d) == t)
+                {
+                    fprintf(file, "%s case %lu:", (cases > 0 && cases % 8 == 0) ? "\n       " : "", d);
+                    done[d] = true;
+                    ++cases;
+                }
+            }
+
+            fprintf(file, " goto state_%d;\n", t);
+        }
+
+        fprintf(file, "        default: *len = (size_t) (end - (const unsigned char*) string); return tag;\n    }\n");
+    }
+
+    fprintf(file, "}\n");
+    free(entered);
+
+    if (ferror(file) || fclose(file) != 0)
+    {
+        return IO_ERROR;
+    }
+
+    return OK;
+}
+
+void dfa_destroy(dfa_t* dfa)
+{
+    if (dfa == NULL)
+    {
+        return;
+    }
+
+    free(dfa->table);
+    free(dfa->final);
+    free(dfa->tags);
+
+    dfa->table = NULL;
+    dfa->final = NULL;
+    dfa->tags = NULL;
+    dfa->class_map = NULL;
+    dfa->states_len = 0;
+    dfa->classes_len = 0;
+}
+
+int lazy_dfa_init(lazy_dfa_t* dfa, const nfa_t* nfa, size_t budget)
+{
+    #ifdef _DEBUG
+    assert(dfa != NULL);
+    assert(nfa != NULL);
+    assert(nfa->states_len > 0);
+    #endif
+
+    if (budget == 0)
+    {
+        budget = LAZY_DFA_DEFAULT_BUDGET;
+    }
+
+    // set, row, final flag and at most 4 hash buckets per state
+    size_t words = (nfa->states_len + SUBSET_WORD_BITS - 1) / SUBSET_WORD_BITS;
+    size_t state_size = sizeof(uint64_t) * words + sizeof(int) * ASCII_LEN + sizeof(bool) + 4 * sizeof(int);
+
+    dfa->nfa = nfa;
+    dfa->states_max = budget / state_size;
+    if (dfa->states_max < LAZY_DFA_MIN_STATES)
+    {
+        dfa->states_max = LAZY_DFA_MIN_STATES;
+    }
+
+    dfa->table = NULL;
+    dfa->final = NULL;
+    dfa->sets = NULL;
+    dfa->walked = 0;
+    dfa->flushes = 0;
+    dfa->fallbacks = 0;
+
+    ERROR_RETHROW(subset_init(&dfa->subset, nfa->states_len, dfa->states_max));
+
+    // the set being added, then the initial set
+    if ((dfa->table = malloc(sizeof(int) * dfa->states_max * ASCII_LEN)) == NULL
+        || (dfa->final = malloc(sizeof(bool) * dfa->states_max)) == NULL
+        || (dfa->sets = calloc(2 * words, sizeof(uint64_t))) == NULL)
+    {
+        lazy_dfa_destroy(dfa);
+        return BAD_ALLOCATION;
+    }
+
+    dfa->sets[words] = 1;
+    ERROR_RETHROW(lazy_dfa_add(dfa, &dfa->sets[words]), lazy_dfa_destroy(dfa));
+
+    return OK;
+}
+
+int lazy_dfa_accepts(lazy_dfa_t* dfa, const char* string, bool* result)
+{
+    #ifdef _DEBUG
+    assert(dfa != NULL);
+    assert(dfa->table != NULL);
+    assert(string != NULL);
+    #endif
+
+    *result = false;
+
+    int state = 0;
+    size_t i;
+    for (i=0; string[i] != '\0'; ++i)
+    {
+        unsigned char c = (unsigned char) string[i];
+        if (c >= ASCII_LEN)
+        {
+            return OK;
+        }
+
+        int next = dfa->table[(size_t) state * ASCII_LEN + c];
+        if (next == LAZY_DFA_UNKNOWN)
+        {
+            size_t walked = dfa->walked;
+            size_t flushes = dfa->flushes;
+
+            ERROR_RETHROW(lazy_dfa_state(dfa, state, c, &next));
+
+            // THRASHING: the cache does not pay off, finish on the NFA
+            if (dfa->flushes != flushes && walked < LAZY_DFA_MIN_CHARS_PER_STATE * dfa->states_max)
+            {
+                ++dfa->fallbacks;
+                return lazy_dfa_fallback(dfa, string, result);
+            }
+        }
+
+        if (next == DFA_DEAD_STATE)
+        {
+            return OK;
+        }
+
+        state = next;
+        ++dfa->walked;
+    }
+
+    *result = dfa->final[state];
+    return OK;
+}
+
+void lazy_dfa_destroy(lazy_dfa_t* dfa)
+{
+    subset_deinit(&dfa->subset);
+    free(dfa->table);
+    free(dfa->final);
+    free(dfa->sets);
+
+    dfa->table = NULL;
+    dfa->final = NULL;
+    dfa->sets = NULL;
+    dfa->states_max = 0;
+}
+
+/*** INTERNAL ***/
+
+// Writes path.h, declaring the generated definition of name
+static int dfa_generate_header(const char* path, const char* name, const char* declaration)
+{
+    char filename[strlen(path) + 3];
+    snprintf(filename, sizeof(filename), "%s.h", path);
+
+    FILE* file;
+    if ((file = fopen(filename, "w")) == NULL)
+    {
+        return IO_ERROR;
+    }
+
+    char guard[strlen(name) + 1];
+    size_t i;
+    for (i=0; name[i] != '\0'; ++i)
+    {
+        guard[i] = (char) toupper((unsigned char) name[i]);
+    }
+    guard[i] = '\0';
+
+    fprintf(file, "/* Generated by build_collection, do not edit */\n");
+    fprintf(file, "#ifndef _%s_H\n#define _%s_H\n\n", guard, guard);
+    fprintf(file, "#include <dfa_builder.h>\n\n");
+    fprintf(file, "%s\n\n#endif\n", declaration);
+
+    if (ferror(file) || fclose(file) != 0)
+    {
+        return IO_ERROR;
+    }
+
+    return OK;
+}
+
+// Opens path.c for writing, past the inclusion of its header
+static FILE* dfa_generate_source(const char* path)
+{
+    char filename[strlen(path) + 3];
+    snprintf(filename, sizeof(filename), "%s.c", path);
+
+    FILE* file;
+    if ((file = fopen(filename, "w")) == NULL)
+    {
+        return NULL;
+    }
+
+    const char* basename = strrchr(path, '/');
+    basename = (basename != NULL) ? basename + 1 : path;
+
+    fprintf(file, "/* Generated by build_collection, do not edit */\n");
+    fprintf(file, "#include \"%s.h\"\n", basename);
+    return file;
+}
+
+// Writes the body of an int array initializer, 16 values per line
+static void dfa_generate_ints(FILE* file, const int* values, size_t len)
+{
+    size_t i;
+    for (i=0; i<len; ++i)
+    {
+        fprintf(file, "%s%d,", (i % 16 == 0) ? "\n    " : " ", values[i]);
+    }
+
+    fprintf(file, "\n};\n");
+}
+
+// Runs the DFA on the string, returns the reached state or DFA_DEAD_STATE
+static int dfa_walk(const dfa_t* dfa, const char* string)
+{
+    int state = 0;
+    size_t i;
+    for (i=0; string[i] != '\0'; ++i)
+    {
+        unsigned char c = (unsigned char) string[i];
+        if (c >= ASCII_LEN)
+        {
+            return DFA_DEAD_STATE;
+        }
+
+        if ((state = dfa->table[(size_t) state * dfa->classes_len + dfa_column(dfa, c)]) == DFA_DEAD_STATE)
+        {
+            return DFA_DEAD_STATE;
+        }
+    }
+
+    return state;
+}
+
+// Walks DFA_BATCH_LANES strings in lockstep, storing the state each of them ends in
+static void dfa_batch_scalar(const dfa_t* dfa, const int* columns, const char* const* strings, int* states)
+{
+    unsigned int active = (1u << DFA_BATCH_LANES) - 1;
+
+    size_t lane;
+    for (lane=0; lane<DFA_BATCH_LANES; ++lane)
+    {
+        states[lane] = 0;
+    }
+
+    size_t i;
+    for (i=0; active != 0; ++i)
+    {
+        for (lane=0; lane<DFA_BATCH_LANES; ++lane)
+        {
+            if (!(active & (1u << lane)))
+            {
+                continue;
+            }
+
+            unsigned char c = (unsigned char) strings[lane][i];
+            if (c == '\0')
+            {
+                active &= ~(1u << lane);
+                continue;
+            }
+
+            states[lane] = (c < ASCII_LEN)
+                ? dfa->table[(size_t) states[lane] * dfa->classes_len + (size_t) columns[c]]
+                : DFA_DEAD_STATE;
+
+            if (states[lane] == DFA_DEAD_STATE)
+            {
+                active &= ~(1u << lane);
+            }
+        }
+    }
+}
+
+#ifdef DFA_BATCH_AVX2
+// As dfa_batch_scalar, the lanes moving together with one gather from the table per character
+__attribute__((target("avx2")))
+static void dfa_batch_avx2(const dfa_t* dfa, const int* columns, const char* const* strings, int* states)
+{
+    const __m256i width = _mm256_set1_epi32((int) dfa->classes_len);
+    const __m256i dead = _mm256_set1_epi32(DFA_DEAD_STATE);
+    const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+
+    __m256i state = _mm256_setzero_si256();
+    unsigned int active = (1u << DFA_BATCH_LANES) - 1;
+    unsigned int rejected = 0;
+
+    size_t i;
+    for (i=0; active != 0; ++i)
+    {
+        int column[DFA_BATCH_LANES] = {0};
+
+        size_t lane;
+        for (lane=0; lane<DFA_BATCH_LANES; ++lane)
+        {
+            if (!(active & (1u << lane)))
+            {
+                continue;
+            }
+
+            unsigned char c = (unsigned char) strings[lane][i];
+            if (c == '\0' || c >= ASCII_LEN)
+            {
+                active &= ~(1u << lane);
+                rejected |= (c != '\0') ? (1u << lane) : 0;
+                continue;
+            }
+
+            column[lane] = columns[c];
+        }
+
+        // only the active lanes load their target, the others keep their state
+        __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int) active), lane_bits), lane_bits);
+        __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(state, width), _mm256_loadu_si256((const __m256i*) column));
+        state = _mm256_mask_i32gather_epi32(state, dfa->table, index, mask, sizeof(int));
+
+        active &= ~(unsigned int) _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(state, dead)));
+    }
+
+    _mm256_storeu_si256((__m256i*) states, state);
+
+    size_t lane;
+    for (lane=0; lane<DFA_BATCH_LANES; ++lane)
+    {
+        if (rejected & (1u << lane))
+        {
+            states[lane] = DFA_DEAD_STATE;
+        }
+    }
+}
+#endif
+
+static void prefilter_init(prefilter_t* prefilter, const dfa_t* dfa)
+{
+    prefilter->nullable = dfa->final[0];
+
+    prefilter->first_len = 0;
+    size_t c;
+    for (c=0; c<ASCII_LEN; ++c)
+    {
+        prefilter->first[c] = (dfa_next(dfa, 0, c) != DFA_DEAD_STATE);
+        prefilter->first_len += prefilter->first[c];
+    }
+
+    // the prefix goes on as long as a single character leaves a non final state
+    int state = 0;
+    prefilter->prefix_len = 0;
+    while (prefilter->prefix_len < PREFILTER_MAX_PREFIX && !dfa->final[state])
+    {
+        size_t targets = 0;
+        int next = DFA_DEAD_STATE;
+        char only = '\0';
+
+        for (c=0; c<ASCII_LEN && targets < 2; ++c)
+        {
+            int target = dfa_next(dfa, (size_t) state, c);
+            if (target != DFA_DEAD_STATE)
+            {
+                ++targets;
+                next = target;
+                only = (char) c;
+            }
+        }
+
+        if (targets != 1)
+        {
+            break;
+        }
+
+        prefilter->prefix[prefilter->prefix_len++] = only;
+        state = next;
+    }
+}
+
+/*
+    Moves start to the next position from start where a match can begin, false if none is left.
+    A literal prefix is looked for with memchr on its first character, a set of
+    first characters by a lookup per character.
+*/
+static bool prefilter_next(const prefilter_t* prefilter, const char* buffer, size_t len, size_t* start)
+{
+    size_t i = *start;
+
+    if (prefilter->nullable)
+    {
+        return i <= len;
+    }
+
+    if (prefilter->first_len == 0)
+    {
+        return false;
+    }
+
+    if (prefilter->prefix_len > 0)
+    {
+        const char* found;
+        while (i + prefilter->prefix_len <= len && (found = memchr(buffer + i, prefilter->prefix[0], len - i)) != NULL)
+        {
+            i = (size_t) (found - buffer);
+            if (i + prefilter->prefix_len > len)
+            {
+                break;
+            }
+
+            if (memcmp(found + 1, prefilter->prefix + 1, prefilter->prefix_len - 1) == 0)
+            {
+                *start = i;
+                return true;
+            }
+            ++i;
+        }
+
+        return false;
+    }
+
+    for (; i<len; ++i)
+    {
+        unsigned char c = (unsigned char) buffer[i];
+        if (c < ASCII_LEN && prefilter->first[c])
+        {
+            *start = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int search_init(search_t* search, const dfa_t* dfa)
+{
+    size_t n = dfa->states_len;
+
+    search->dfa = dfa;
+    search->states_len = 0;
+    search->head = 0;
+    search->tail = 0;
+    search->capacity = 0;
+    search->levels = NULL;
+
+    // the arrays trade places at every step, each is allocated on its own
+    search->level = malloc(sizeof(size_t) * n);
+    search->start = malloc(sizeof(size_t) * n);
+    search->next_level = malloc(sizeof(size_t) * n);
+    search->next_start = malloc(sizeof(size_t) * n);
+    search->states = malloc(sizeof(int) * n);
+    search->next_states = malloc(sizeof(int) * n);
+
+    if (search->level == NULL || search->start == NULL || search->next_level == NULL
+        || search->next_start == NULL || search->states == NULL || search->next_states == NULL)
+    {
+        search_deinit(search);
+        return BAD_ALLOCATION;
+    }
+
+    size_t s;
+    for (s=0; s<n; ++s)
+    {
+        search->level[s] = SEARCH_NO_THREAD;
+        search->next_level[s] = SEARCH_NO_THREAD;
+    }
+
+    // the first level searches from the start of the buffer
+    ERROR_RETHROW(search_push(search, 0), search_deinit(search));
+    return OK;
+}
+
+static void search_deinit(search_t* search)
+{
+    free(search->level);
+    free(search->start);
+    free(search->next_level);
+    free(search->next_start);
+    free(search->states);
+    free(search->next_states);
+    free(search->levels);
+}
+
+// Adds a level searching from floor after the last one
+static int search_push(search_t* search, size_t floor)
+{
+    if (search->tail == search->capacity)
+    {
+        // the settled levels before head make room first, their threads are gone
+        if (search->head > 0)
+        {
+            size_t shift = search->head, k;
+            memmove(search->levels, search->levels + shift, sizeof(search_level_t) * (search->tail - shift));
+            for (k=0; k<search->states_len; ++k)
+            {
+                search->level[search->states[k]] -= shift;
+            }
+
+            search->head = 0;
+            search->tail -= shift;
+        }
+        else
+        {
+            size_t new_capacity = (search->capacity == 0) ? 8 : search->capacity * 2;
+            search_level_t* new_levels;
+            if ((new_levels = reallocarray(search->levels, new_capacity, sizeof(search_level_t))) == NULL)
+            {
+                return BAD_ALLOCATION;
+            }
+
+            search->levels = new_levels;
+            search->capacity = new_capacity;
+        }
+    }
+
+    search_level_t* level = &search->levels[search->tail++];
+    level->floor = floor;
+    level->matched = false;
+    level->threads = 0;
+    return OK;
+}
+
+// Starts a thread in state for level at position start, unless an earlier one is there
+static void search_insert(search_t* search, int state, size_t level, size_t start)
+{
+    size_t current = search->level[state];
+    if (current != SEARCH_NO_THREAD
+        && (current < level || (current == level && search->start[state] <= start)))
+    {
+        return;
+    }
+
+    if (current == SEARCH_NO_THREAD)
+    {
+        search->states[search->states_len++] = state;
+    }
+    else
+    {
+        --search->levels[current].threads;
+    }
+
+    search->level[state] = level;
+    search->start[state] = start;
+    ++search->levels[level].threads;
+}
+
+// Moves every thread on character c, merging the threads meeting in a state
+static void search_step(search_t* search, unsigned char c)
+{
+    const dfa_t* dfa = search->dfa;
+    size_t next_len = 0, k;
+
+    for (k=0; k<search->states_len; ++k)
+    {
+        int state = search->states[k];
+        size_t level = search->level[state];
+        size_t start = search->start[state];
+        search->level[state] = SEARCH_NO_THREAD;
+
+        int target = (c < ASCII_LEN) ? dfa_next(dfa, (size_t) state, c) : DFA_DEAD_STATE;
+        if (target == DFA_DEAD_STATE)
+        {
+            --search->levels[level].threads;
+            continue;
+        }
+
+        size_t current = search->next_level[target];
+        if (current == SEARCH_NO_THREAD)
+        {
+            search->next_states[next_len++] = target;
+        }
+        else if (current < level || (current == level && search->next_start[target] <= start))
+        {
+            --search->levels[level].threads;
+            continue;
+        }
+        else
+        {
+            --search->levels[current].threads;
+        }
+
+        search->next_level[target] = level;
+        search->next_start[target] = start;
+    }
+
+    // the next threads become the current ones
+    size_t* temp = search->level;
+    search->level = search->next_level;
+    search->next_level = temp;
+
+    temp = search->start;
+    search->start = search->next_start;
+    search->next_start = temp;
+
+    int* temp_states = search->states;
+    search->states = search->next_states;
+    search->next_states = temp_states;
+    search->states_len = next_len;
+}
+
+/*
+    Records the match [start, end) of level, the leftmost-longest so far: the
+    threads of the level starting after it and every later level are dropped,
+    a new level searches after it.
+*/
+static int search_match(search_t* search, size_t level, size_t start, size_t end, int tag)
+{
+    search_level_t* current = &search->levels[level];
+    current->matched = true;
+    current->start = start;
+    current->end = end;
+    current->tag = tag;
+
+    size_t kept = 0, k;
+    for (k=0; k<search->states_len; ++k)
+    {
+        int state = search->states[k];
+        if (search->level[state] > level || (search->level[state] == level && search->start[state] > start))
+        {
+            current->threads -= (search->level[state] == level);
+            search->level[state] = SEARCH_NO_THREAD;
+            continue;
+        }
+
+        search->states[kept++] = state;
+    }
+    search->states_len = kept;
+
+    // an empty match moves on by one character
+    search->tail = level + 1;
+    return search_push(search, (end > start) ? end : end + 1);
+}
+
+// Records the match of the lowest level reaching a final state at position end
+static int search_finals(search_t* search, size_t end)
+{
+    const dfa_t* dfa = search->dfa;
+    int found = DFA_DEAD_STATE;
+
+    size_t k;
+    for (k=0; k<search->states_len; ++k)
+    {
+        int state = search->states[k];
+        if (dfa->final[state]
+            && (found == DFA_DEAD_STATE
+                || search->level[state] < search->level[found]
+                || (search->level[state] == search->level[found] && search->start[state] < search->start[found])))
+        {
+            found = state;
+        }
+    }
+
+    if (found == DFA_DEAD_STATE)
+    {
+        return OK;
+    }
+
+    return search_match(search, search->level[found], search->start[found], end,
+        (dfa->tags != NULL) ? dfa->tags[found] : 0);
+}
+
+// Reports the matches of the first levels no thread can change anymore (all of them at the end)
+static int search_report(search_t* search, dfa_search_callback_t callback, void* context, bool end)
+{
+    while (search->head < search->tail && search->levels[search->head].matched
+        && (end || search->levels[search->head].threads == 0))
+    {
+        const search_level_t* level = &search->levels[search->head++];
+        ERROR_RETHROW(callback(level->start, level->end - level->start, level->tag, context));
+    }
+
+    return OK;
+}
+
+// Grows the DFA tables (and the tags if tagged) so that they can hold at least n states
+static int dfa_reserve(dfa_t* dfa, size_t* capacity, size_t n, bool tagged)
+{
+    if (n <= *capacity)
+    {
+        return OK;
+    }
+
+    size_t new_capacity = (*capacity == 0) ? 8 : *capacity * 2;
+    while (new_capacity < n)
+    {
+        new_capacity *= 2;
+    }
+
+    int* new_table;
+    bool* new_final;
+
+    if ((new_table = reallocarray(dfa->table, new_capacity * dfa->classes_len, sizeof(int))) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+    dfa->table = new_table;
+
+    if ((new_final = reallocarray(dfa->final, new_capacity, sizeof(bool))) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+    dfa->final = new_final;
+
+    if (tagged)
+    {
+        int* new_tags;
+        if ((new_tags = reallocarray(dfa->tags, new_capacity, sizeof(int))) == NULL)
+        {
+            return BAD_ALLOCATION;
+        }
+        dfa->tags = new_tags;
+    }
+
+    *capacity = new_capacity;
+    return OK;
+}
+
+// Column of the table for character c
+static inline size_t dfa_column(const dfa_t* dfa, size_t c)
+{
+    return (dfa->class_map != NULL) ? dfa->class_map[c] : c;
+}
+
+// Target of state s on character c
+static inline int dfa_next(const dfa_t* dfa, size_t s, size_t c)
+{
+    return dfa->table[s * dfa->classes_len + dfa_column(dfa, c)];
+}
+
+// Transition on class c of the completed DFA, where the state states_len is the dead state
+static size_t dfa_target(const dfa_t* dfa, size_t s, size_t c)
+{
+    if (s == dfa->states_len || dfa->table[s * dfa->classes_len + c] == DFA_DEAD_STATE)
+    {
+        return dfa->states_len;
+    }
+
+    return (size_t) dfa->table[s * dfa->classes_len + c];
+}
+
+// Moves s among the marked states of its block
+static void partition_mark(partition_t* partition, size_t s, size_t* touched, size_t* touched_len)
+{
+    size_t b = partition->block[s];
+    size_t boundary = partition->first[b] + partition->marked[b];
+
+    if (partition->location[s] < boundary)
+    {
+        return;
+    }
+
+    if (partition->marked[b] == 0)
+    {
+        touched[(*touched_len)++] = b;
+    }
+
+    // swap s with the first unmarked state
+    size_t other = partition->elements[boundary];
+    partition->elements[partition->location[s]] = other;
+    partition->location[other] = partition->location[s];
+    partition->elements[boundary] = s;
+    partition->location[s] = boundary;
+
+    ++partition->marked[b];
+}
+
+// Splits the marked states of block b off into a new block, returns it (b if nothing was split)
+static size_t partition_split(partition_t* partition, size_t b)
+{
+    size_t marked = partition->marked[b];
+    partition->marked[b] = 0;
+
+    if (marked == partition->end[b] - partition->first[b])
+    {
+        return b;
+    }
+
+    size_t nb = partition->blocks_len++;
+    partition->first[nb] = partition->first[b];
+    partition->end[nb] = partition->first[b] + marked;
+    partition->marked[nb] = 0;
+    partition->first[b] = partition->end[nb];
+
+    size_t i;
+    for (i=partition->first[nb]; i<partition->end[nb]; ++i)
+    {
+        partition->block[partition->elements[i]] = nb;
+    }
+
+    return nb;
+}
+
+// Computes the target of state on c, flushing the cache if a new state does not fit
+static int lazy_dfa_state(lazy_dfa_t* dfa, int state, unsigned char c, int* next)
+{
+    const nfa_t* nfa = dfa->nfa;
+    size_t words = dfa->subset.set_words;
+    uint64_t* set = dfa->sets;
+
+    memset(set, 0, sizeof(uint64_t) * words);
+
+    size_t w;
+    for (w=0; w<words; ++w)
+    {
+        uint64_t bits = dfa->subset.sets[(size_t) state * words + w];
+        while (bits != 0)
+        {
+            const state_t* nfa_state = &nfa->states[w * SUBSET_WORD_BITS + (size_t) __builtin_ctzll(bits)];
+            bits &= bits - 1;
+
+            size_t j;
+            for (j=0; j<nfa_state->len; ++j)
+            {
+                if ((unsigned char) nfa_state->charset[j] == c)
+                {
+                    size_t t = (size_t) nfa_state->mapped_state[j];
+                    set[t / SUBSET_WORD_BITS] |= (uint64_t) 1 << (t % SUBSET_WORD_BITS);
+                }
+            }
+        }
+    }
+
+    if (subset_empty(set, words))
+    {
+        *next = DFA_DEAD_STATE;
+    }
+    else if ((*next = subset_find(&dfa->subset, set)) == -1)
+    {
+        if (dfa->subset.sets_len >= dfa->states_max)
+        {
+            // the row of state is gone with the flush: the transition is not cached
+            ERROR_RETHROW(lazy_dfa_flush(dfa));
+            ERROR_RETHROW(lazy_dfa_add(dfa, set));
+            *next = (int) dfa->subset.sets_len - 1;
+            return OK;
+        }
+
+        ERROR_RETHROW(lazy_dfa_add(dfa, set));
+        *next = (int) dfa->subset.sets_len - 1;
+    }
+
+    dfa->table[(size_t) state * ASCII_LEN + c] = *next;
+    return OK;
+}
+
+// Caches the state standing for set, with all of its transitions unknown
+static int lazy_dfa_add(lazy_dfa_t* dfa, const uint64_t* set)
+{
+    #ifdef _DEBUG
+    assert(dfa->subset.sets_len < dfa->states_max);
+    #endif
+
+    int index;
+    ERROR_RETHROW(subset_lookup(&dfa->subset, set, &index));
+
+    size_t c;
+    for (c=0; c<ASCII_LEN; ++c)
+    {
+        dfa->table[(size_t) index * ASCII_LEN + c] = LAZY_DFA_UNKNOWN;
+    }
+
+    dfa->final[index] = false;
+
+    size_t w;
+    for (w=0; w<dfa->subset.set_words; ++w)
+    {
+        uint64_t bits = set[w];
+        while (bits != 0)
+        {
+            if (dfa->nfa->states[w * SUBSET_WORD_BITS + (size_t) __builtin_ctzll(bits)].final)
+            {
+                dfa->final[index] = true;
+            }
+            bits &= bits - 1;
+        }
+    }
+
+    return OK;
+}
+
+// Empties the cache but for the initial state, which stays state 0
+static int lazy_dfa_flush(lazy_dfa_t* dfa)
+{
+    subset_clear(&dfa->subset);
+    dfa->walked = 0;
+    ++dfa->flushes;
+
+    return lazy_dfa_add(dfa, &dfa->sets[dfa->subset.set_words]);
+}
+
+// Matches the whole string on the NFA
+static int lazy_dfa_fallback(const lazy_dfa_t* dfa, const char* string, bool* result)
+{
+    match_t match;
+    ERROR_RETHROW(match_begin(&match, dfa->nfa));
+
+    size_t i;
+    for (i=0; string[i] != '\0' && !match_is_dead(&match); ++i)
+    {
+        if ((unsigned char) string[i] >= ASCII_LEN)
+        {
+            match_end(&match);
+            *result = false;
+            return OK;
+        }
+
+        match_feed(&match, string[i]);
+    }
+
+    *result = match_is_accepting(&match);
+    match_end(&match);
+    return OK;
+}
+
+static int subset_init(subset_t* subset, size_t nfa_states, size_t sets_capacity)
+{
+    subset->set_words = (nfa_states + SUBSET_WORD_BITS - 1) / SUBSET_WORD_BITS;
+    subset->sets_len = 0;
+    subset->sets_capacity = sets_capacity;
+
+    // room for sets_capacity states below the maximum load factor
+    subset->buckets_len = 16;
+    while (subset->buckets_len < sets_capacity * 2)
+    {
+        subset->buckets_len *= 2;
+    }
+
+    if ((subset->sets = malloc(sizeof(uint64_t) * subset->set_words * subset->sets_capacity)) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+
+    if ((subset->buckets = malloc(sizeof(int) * subset->buckets_len)) == NULL)
+    {
+        free(subset->sets);
+        return BAD_ALLOCATION;
+    }
+
+    memset(subset->buckets, -1, sizeof(int) * subset->buckets_len);
+    return OK;
+}
+
+// Forgets every set, keeping the memory
+static void subset_clear(subset_t* subset)
+{
+    subset->sets_len = 0;
+    memset(subset->buckets, -1, sizeof(int) * subset->buckets_len);
+}
+
+static void subset_deinit(subset_t* subset)
+{
+    free(subset->sets);
+    free(subset->buckets);
+
+    subset->sets = NULL;
+    subset->buckets = NULL;
+    subset->sets_len = 0;
+    subset->sets_capacity = 0;
+    subset->buckets_len = 0;
+}
+
+// Finds the DFA state standing for set, creating it if it does not exist yet
+static int subset_lookup(subset_t* subset, const uint64_t* set, int* index)
+{
+    size_t words = subset->set_words;
+    size_t mask = subset->buckets_len - 1;
+    size_t b = subset_hash(set, words) & mask;
+
+    while (subset->buckets[b] != -1)
+    {
+        if (memcmp(&subset->sets[(size_t) subset->buckets[b] * words], set, sizeof(uint64_t) * words) == 0)
+        {
+            *index = subset->buckets[b];
+            return OK;
+        }
+
+        b = (b + 1) & mask;
+    }
+
+    // NEW STATE
+    if (subset->sets_len >= subset->sets_capacity)
+    {
+        uint64_t* new_sets;
+        if ((new_sets = reallocarray(subset->sets, subset->sets_capacity * 2 * words, sizeof(uint64_t))) == NULL)
+        {
+            return BAD_ALLOCATION;
+        }
+
+        subset->sets = new_sets;
+        subset->sets_capacity *= 2;
+    }
+
+    memcpy(&subset->sets[subset->sets_len * words], set, sizeof(uint64_t) * words);
+    subset->buckets[b] = (int) subset->sets_len;
+    *index = (int) subset->sets_len;
+    ++subset->sets_len;
+
+    // keep the load factor below 1/2
+    if (subset->sets_len * 2 > subset->buckets_len)
+    {
+        ERROR_RETHROW(subset_rehash(subset));
+    }
+
+    return OK;
+}
+
+// Finds the DFA state standing for set, -1 if there is none
+static int subset_find(const subset_t* subset, const uint64_t* set)
+{
+    size_t words = subset->set_words;
+    size_t mask = subset->buckets_len - 1;
+    size_t b = subset_hash(set, words) & mask;
+
+    while (subset->buckets[b] != -1)
+    {
+        if (memcmp(&subset->sets[(size_t) subset->buckets[b] * words], set, sizeof(uint64_t) * words) == 0)
+        {
+            return subset->buckets[b];
+        }
+
+        b = (b + 1) & mask;
+    }
+
+    return -1;
+}
+
+static int subset_rehash(subset_t* subset)
+{
+    size_t new_len = subset->buckets_len * 2;
+    size_t mask = new_len - 1;
+
+    int* new_buckets;
+    if ((new_buckets = malloc(sizeof(int) * new_len)) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+    memset(new_buckets, -1, sizeof(int) * new_len);
+
+    size_t i;
+    for (i=0; i<subset->sets_len; ++i)
+    {
+        size_t b = subset_hash(&subset->sets[i * subset->set_words], subset->set_words) & mask;
+        while (new_buckets[b] != -1)
+        {
+            b = (b + 1) & mask;
+        }
+        new_buckets[b] = (int) i;
+    }
+
+    free(subset->buckets);
+    subset->buckets = new_buckets;
+    subset->buckets_len = new_len;
+    return OK;
+}
+
+// FNV-1a over the words of the set
+static size_t subset_hash(const uint64_t* set, size_t words)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    size_t i;
+    for (i=0; i<words; ++i)
+    {
+        h ^= set[i];
+        h *= 1099511628211ULL;
+    }
+
+    return (size_t) (h ^ (h >> 32));
+}
+
+static bool subset_empty(const uint64_t* set, size_t words)
+{
+    size_t i;
+    for (i=0; i<words; ++i)
+    {
+        if (set[i] != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -1,8 +1,30 @@
 #include <lexer.h>
 #include <compiler_errors.h>
+#include <token_tables.h>
+#include <token_scanner.h>
+#include <errno.h>
+#include <unistd.h>
 
 #define REGBUFFER_LEN (sizeof(regex_buffer) / sizeof(regex_buffer[0]))
 
+/*
+	Longest token scan, resumed when more characters come: the first scanned
+	characters of the token lead the merged DFA to state, and the longest token
+	among them is tag (NFA_NO_TAG if none), len characters long.
+*/
+typedef struct _tokenizer_scan{
+	int state;
+	size_t scanned;
+	int tag;
+	size_t len;
+} tokenizer_scan_t;
+
+static void tokenizer_list_release(toklist_t*);
+static void tokenizer_scan_begin(tokenizer_scan_t*);
+static bool tokenizer_longest(const dfa_t*, tokenizer_scan_t*, const char*, size_t);
+static int tokenizer_append(void*, toktype_t, const char*, size_t);
+static ssize_t tokenizer_read_fd(void*, char*, size_t);
+
 /*
 static const char* regex_buffer[] = { 
 				"\n+\t+ ",
@@ -30,13 +52,90 @@ int tokenizer_init(toklist_t* toklist, const char* nfa_collection_filename){
 	assert(nfa_collection_filename != NULL);
 	#endif
 
-	ERROR_RETHROW(nfa_collection_load(
+	toklist->list = NULL;
+	toklist->list_capacity = 0;
+	toklist->list_size = 0;
+	toklist->merged_dfa = NULL;
+	toklist->builtin = false;
+	toklist->scan = NULL;
+	toklist->shared = false;
+
+	// the collection, its merged NFA and its byte classes come from a single mapping of the file
+	nfa_t merged;
+	ERROR_RETHROW(nfa_collection_open(
 			&(toklist->nfa_collection),
 			&(toklist->nfa_collection_size),
+			&merged,
+			toklist->class_map,
+			&(toklist->classes_len),
 			nfa_collection_filename
 		)
 	);
 
+	// a single tagged DFA classifies a token in one pass
+	if ((toklist->merged_dfa = calloc(sizeof(dfa_t), 1)) == NULL)
+	{
+		nfa_destroy(&merged);
+		tokenizer_deinit(toklist);
+		return BAD_ALLOCATION;
+	}
+
+	ERROR_RETHROW(
+		dfa_from_nfa(toklist->merged_dfa, &merged),
+		nfa_destroy(&merged); tokenizer_deinit(toklist)
+	);
+	nfa_destroy(&merged);
+
+	ERROR_RETHROW(
+		dfa_compress(toklist->merged_dfa, toklist->class_map, toklist->classes_len),
+		tokenizer_deinit(toklist)
+	);
+
+	ERROR_RETHROW(
+		dfa_minimize(toklist->merged_dfa),
+		tokenizer_deinit(toklist)
+	);
+
+	return OK;
+}
+
+int tokenizer_init_builtin(toklist_t* toklist)
+{
+	#ifdef _DEBUG
+	assert(toklist != NULL);
+	#endif
+
+	toklist->list = NULL;
+	toklist->list_capacity = 0;
+	toklist->list_size = 0;
+	toklist->nfa_collection = NULL;
+	toklist->nfa_collection_size = 0;
+	toklist->shared = false;
+
+	// read only, shared by every tokenizer
+	toklist->merged_dfa = (dfa_t*) &token_dfa;
+	toklist->builtin = true;
+
+	// the direct-coded scanner of the same DFA, faster than walking its tables
+	toklist->scan = token_scan;
+
+	memcpy(toklist->class_map, token_dfa.class_map, sizeof(toklist->class_map));
+	toklist->classes_len = token_dfa.classes_len;
+
+	return OK;
+}
+
+int tokenizer_init_shared(toklist_t* toklist, const toklist_t* source)
+{
+	#ifdef _DEBUG
+	assert(toklist != NULL);
+	assert(source != NULL);
+	#endif
+
+	// the automata are copied by reference, tokenize only reads them
+	*toklist = *source;
+	toklist->shared = true;
+
 	toklist->list = NULL;
 	toklist->list_capacity = 0;
 	toklist->list_size = 0;
@@ -44,110 +143,166 @@ int tokenizer_init(toklist_t* toklist, const char* nfa_collection_filename){
 	return OK;
 }
 
-int tokenize(toklist_t* token_list, char* buffer)
+int tokenize(toklist_t* token_list, const char* buffer)
 {
 	size_t buffer_len = strlen(buffer);
 	
 	if (buffer_len == 0)
 		return INVALID_BUFFER;
 	
-	// Setting up
-	token_t* new_list;
-	if ((new_list = malloc(
+	// Setting up: the tokens of a previous call are dropped
+	tokenizer_list_release(token_list);
+
+	if ((token_list->list = malloc(
 			ASCII_LEN * sizeof(token_t)
 		)) == NULL)
 	{
 		return BAD_ALLOCATION;
 	}
 
-	token_list->list = new_list;
-	token_list->list_size = 0;
 	token_list->list_capacity = ASCII_LEN;
-	
-	size_t i = 1;
-	size_t previous_index = 1;
+
+	// MAXIMAL MUNCH: THE LONGEST TOKEN FROM base_index, THE FIRST TOKEN TYPE AMONG THE LONGEST
 	size_t base_index = 0;
-	
-	toktype_t tt = NOTOK;
-	
-	 
-	while (i <= buffer_len){
-		
-		char temp_char;
-		size_t j;
-		bool accepted = false;
-		
-		temp_char = buffer[i];
-		buffer[i] = '\0';
-		
+	while (base_index < buffer_len){
+
+		int tag;
+		size_t len;
 
-		// allocate new token
-		if (token_list->list_size >= token_list->list_capacity)
+		if (token_list->scan != NULL)
 		{
-			size_t new_capacity = token_list->list_capacity * 2;
-			token_t* new_list;
-			
-			// RESIZE
-			if ((new_list = reallocarray(
-				token_list->list, new_capacity, sizeof(token_t)
-				)) == NULL)
-			{
-				tokenizer_deinit(token_list);
-				return BAD_ALLOCATION;
-			}
+			tag = token_list->scan(&(buffer[base_index]), &len);
 		}
-		
-		
-		
-		for (j=0; j<token_list->nfa_collection_size; ++j)
+		else
 		{
 			ERROR_RETHROW(
-				nfa_accepts(
-					&(token_list->nfa_collection[j]),
-					&(buffer[base_index]),
-					&accepted
-				),
+				dfa_longest_match(token_list->merged_dfa, &(buffer[base_index]), &tag, &len),
 				tokenizer_deinit(token_list)
 			);
+		}
 
-			if (accepted)
-			{
-				break;
-			}
+		//means characters are not recognized, throw error
+		if (tag == NFA_NO_TAG || len == 0 || (toktype_t) tag == NOTOK)
+		{
+			tokenizer_deinit(token_list);
+			return INVALID_TOKEN;
 		}
 
-		buffer[i] = temp_char;
+		ERROR_RETHROW(
+			tokenizer_append(token_list, (toktype_t) tag, &(buffer[base_index]), len),
+			tokenizer_deinit(token_list)
+		);
 
-		if (accepted){ // continue
-			++i;
-			tt = j;
-		}else{
+		base_index += len;
+	}
 
-			//means characters are not recognized, throw error
-			if (i == previous_index || tt == NOTOK)
-			{ 	
-				tokenizer_deinit(token_list);
+	return OK;
+}
+
+int tokenize_stream(const toklist_t* token_list, tokenizer_read_t read_chunk, void* source, tokenizer_consume_t consume, void* context)
+{
+	#ifdef _DEBUG
+	assert(token_list != NULL);
+	assert(read_chunk != NULL);
+	assert(consume != NULL);
+	#endif
+
+	// the window holds the characters read and not tokenized yet, in [start, end)
+	size_t capacity = TOKENIZER_CHUNK_LEN;
+	char* window;
+	if ((window = malloc(capacity)) == NULL)
+	{
+		return BAD_ALLOCATION;
+	}
+
+	size_t start = 0, end = 0;
+	bool eof = false;
+
+	tokenizer_scan_t scan;
+	tokenizer_scan_begin(&scan);
+
+	for (;;)
+	{
+		// A TOKEN STILL GROWING AT THE END OF THE WINDOW WAITS FOR THE NEXT CHUNK, ITS SCAN RESUMES THERE
+		if (tokenizer_longest(token_list->merged_dfa, &scan, window + start, end - start) && !eof)
+		{
+			if (end - start >= TOKENIZER_MAX_TOKEN_LEN)
+			{
+				free(window);
 				return INVALID_TOKEN;
 			}
-			
-			// allocating new token
-			if ((token_list->list[token_list->list_size].tk = calloc(sizeof(char), i-base_index)) == NULL)
+
+			// once the window is full the pending characters move to the front, it grows only for a token longer than it
+			if (end == capacity && start > 0)
 			{
-				tokenizer_deinit(token_list);
-				return BAD_ALLOCATION;
+				memmove(window, window + start, end - start);
+				end -= start;
+				start = 0;
 			}
+			else if (end == capacity)
+			{
+				char* new_window;
+				if ((new_window = realloc(window, capacity * 2)) == NULL)
+				{
+					free(window);
+					return BAD_ALLOCATION;
+				}
 
-			token_list->list[token_list->list_size].tt = tt;
-			strncpy(token_list->list[token_list->list_size].tk, buffer+base_index, i-base_index-1);
-			++token_list->list_size;
+				window = new_window;
+				capacity *= 2;
+			}
 
-			// Setting up for next iteration
-			base_index = i-1; //base_index to the first not recognized character
-			previous_index = i;   //previous_base_index to the current i location for control purposes
+			ssize_t read_len = read_chunk(source, window + end, capacity - end);
+			if (read_len < 0)
+			{
+				free(window);
+				return IO_ERROR;
+			}
+
+			eof = (read_len == 0);
+			end += (size_t) read_len;
+			continue;
 		}
-		
+
+		if (start == end)
+		{
+			break;
+		}
+
+		//means characters are not recognized, throw error
+		if (scan.tag == NFA_NO_TAG || scan.len == 0 || (toktype_t) scan.tag == NOTOK)
+		{
+			free(window);
+			return INVALID_TOKEN;
+		}
+
+		ERROR_RETHROW(consume(context, (toktype_t) scan.tag, window + start, scan.len), free(window));
+		start += scan.len;
+		tokenizer_scan_begin(&scan);
 	}
 
+	free(window);
+	return OK;
+}
+
+int tokenize_fd(toklist_t* token_list, int fd)
+{
+	#ifdef _DEBUG
+	assert(token_list != NULL);
+	#endif
+
+	// Setting up: the tokens of a previous call are dropped
+	tokenizer_list_release(token_list);
+
+	ERROR_RETHROW(
+		tokenize_stream(token_list, tokenizer_read_fd, &fd, tokenizer_append, token_list),
+		tokenizer_deinit(token_list)
+	);
+
+	if (token_list->list_size == 0)
+	{
+		return INVALID_BUFFER;
+	}
 
 	return OK;
 }
@@ -168,6 +323,30 @@ void print_tokens(const toklist_t* token_list){
 
 void tokenizer_deinit(toklist_t* toklist)
 {
+	// a shared tokenizer only owns its token list
+	if (toklist->shared)
+	{
+		toklist->merged_dfa = NULL;
+		toklist->builtin = false;
+		toklist->scan = NULL;
+		toklist->nfa_collection = NULL;
+		toklist->nfa_collection_size = 0;
+		toklist->shared = false;
+	}
+
+	if (toklist->merged_dfa != NULL)
+	{
+		if (!toklist->builtin)
+		{
+			dfa_destroy(toklist->merged_dfa);
+			free(toklist->merged_dfa);
+		}
+
+		toklist->merged_dfa = NULL;
+		toklist->builtin = false;
+		toklist->scan = NULL;
+	}
+
 	if (toklist->nfa_collection_size > 0 && toklist->nfa_collection != NULL)
 	{
 		nfa_collection_delete(toklist->nfa_collection, toklist->nfa_collection_size);
@@ -175,6 +354,12 @@ void tokenizer_deinit(toklist_t* toklist)
 		toklist->nfa_collection_size = 0;
 	}
 
+	tokenizer_list_release(toklist);
+}
+
+// Frees the scanned tokens
+static void tokenizer_list_release(toklist_t* toklist)
+{
 	if (toklist->list_capacity > 0 && toklist->list != NULL)
 	{
 		size_t i;
@@ -187,10 +372,103 @@ void tokenizer_deinit(toklist_t* toklist)
 		}
 		
 		free(toklist->list);
-		toklist->list_capacity = 0;
-		toklist->list_size = 0;
-		toklist->list = NULL;
 	}
+
+	toklist->list_capacity = 0;
+	toklist->list_size = 0;
+	toklist->list = NULL;
+}
+
+// Starts the scan of the next token
+static void tokenizer_scan_begin(tokenizer_scan_t* scan)
+{
+	scan->state = 0;
+	scan->scanned = 0;
+	scan->tag = NFA_NO_TAG;
+	scan->len = 0;
+}
+
+/*
+	Goes on with the scan over the len characters of string, the first
+	scan->scanned of them being already scanned. Returns true if the DFA is still
+	alive after the len characters, so that the characters after them may make a longer token.
+*/
+static bool tokenizer_longest(const dfa_t* dfa, tokenizer_scan_t* scan, const char* string, size_t len)
+{
+	int state = scan->state;
+	size_t i;
+
+	if (state == DFA_DEAD_STATE)
+	{
+		return false;
+	}
+
+	for (i=scan->scanned; i<len; ++i)
+	{
+		unsigned char c = (unsigned char) string[i];
+		if (c >= ASCII_LEN || (state = dfa->table[(size_t) state * dfa->classes_len + dfa->class_map[c]]) == DFA_DEAD_STATE)
+		{
+			scan->state = DFA_DEAD_STATE;
+			scan->scanned = i + 1;
+			return false;
+		}
+
+		if (dfa->final[state])
+		{
+			scan->tag = dfa->tags[state];
+			scan->len = i + 1;
+		}
+	}
+
+	scan->state = state;
+	scan->scanned = len;
+	return true;
+}
+
+// Adds a copy of the len characters of tk to the token list (a tokenizer_consume_t on the list)
+static int tokenizer_append(void* context, toktype_t tt, const char* tk, size_t len)
+{
+	toklist_t* token_list = context;
+
+	// allocate new token
+	if (token_list->list_size >= token_list->list_capacity)
+	{
+		size_t new_capacity = (token_list->list_capacity == 0) ? ASCII_LEN : token_list->list_capacity * 2;
+		token_t* new_list;
+		
+		// RESIZE
+		if ((new_list = reallocarray(
+			token_list->list, new_capacity, sizeof(token_t)
+			)) == NULL)
+		{
+			return BAD_ALLOCATION;
+		}
+
+		token_list->list = new_list;
+		token_list->list_capacity = new_capacity;
+	}
+
+	// allocating new token
+	if ((token_list->list[token_list->list_size].tk = malloc(sizeof(char) * (len + 1))) == NULL)
+	{
+		return BAD_ALLOCATION;
+	}
+
+	token_list->list[token_list->list_size].tt = tt;
+	memcpy(token_list->list[token_list->list_size].tk, tk, len);
+	token_list->list[token_list->list_size].tk[len] = '\0';
+	++token_list->list_size;
+
+	return OK;
+}
+
+// Reads from the file descriptor source (a tokenizer_read_t), again if interrupted
+static ssize_t tokenizer_read_fd(void* source, char* buffer, size_t len)
+{
+	ssize_t read_len;
+	while ((read_len = read(*(const int*) source, buffer, len)) < 0 && errno == EINTR);
+
+	return read_len;
 }
 
 const char* tokenizer_typetokstr(toktype_t tktype){
@@ -1,23 +1,160 @@
 #include <nfa_builder.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <inttypes.h>
 #include <compiler_errors.h>
 
 #ifdef _DEBUG
 #include <assert.h>
 #endif
 
+// Identifies a collection file, "NFA2" as a little endian word
+#define NFA_FILE_MAGIC 0x3241464Eu
+#define NFA_FILE_VERSION 2u
+// Written in the byte order of the machine saving the file
+#define NFA_FILE_ENDIANNESS 0x01020304u
+#define NFA_FILE_ALIGNMENT 8
+// Room for the name of a cache entry after its directory: "/", 16 hex digits, ".dat" and the terminator
+#define NFA_CACHE_NAME_LEN 22
+
+// the targets are mapped in place as the int of state_t
+_Static_assert(sizeof(int) == sizeof(int32_t), "int must be 32 bits wide");
+
+/*
+    A collection file is laid out to be mapped in memory and used in place.
+    The header is followed by arrays at offsets aligned to NFA_FILE_ALIGNMENT:
+    nfas_len NFA records (the collection, then its merged NFA), the state
+    records of all of them, the targets of the transitions, the dense index
+    rows (see nfa_compact), the tags of the merged NFA and the characters of
+    the transitions. Records refer to the arrays by index.
+    checksum is the FNV-1a hash of everything after the header.
+*/
+typedef struct _file_header{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t endianness;
+    uint32_t classes_len;
+    uint64_t file_len;
+    uint64_t checksum;
+    uint64_t nfas_len;
+    uint64_t states_len;
+    uint64_t transitions_len;
+    uint64_t rows_len;
+    uint64_t nfas_offset;
+    uint64_t states_offset;
+    uint64_t targets_offset;
+    uint64_t rows_offset;
+    uint64_t tags_offset;
+    uint64_t charset_offset;
+    unsigned char class_map[ASCII_LEN];
+} file_header_t;
+
+typedef struct _file_nfa{
+    uint64_t states;
+    uint64_t states_len;
+} file_nfa_t;
+
+typedef struct _file_state{
+    uint64_t symbols[SYMBOLS_WORDS];
+    uint64_t transitions;
+    uint64_t row;
+    uint32_t len;
+    uint32_t row_len;
+    uint8_t final;
+    uint8_t deterministic;
+    uint8_t dead;
+    uint8_t padding[5];
+} file_state_t;
+
+/*
+    State of the position automaton construction: the leaves of the tree
+    are the positions 1..positions_len, labels[p] the characters of p.
+    edges holds edges_len (p, q) pairs of the follow relation.
+*/
+typedef struct _glushkov{
+    size_t positions_len;
+    uint64_t (*labels)[SYMBOLS_WORDS];
+    size_t edges_len;
+    size_t edges_capacity;
+    int* edges;
+} glushkov_t;
+
+// A set of positions
+typedef struct _positions{
+    size_t len;
+    int* list;
+} positions_t;
+
+// Frame of glushkov_visit: a node, and whether its children are already visited
+typedef struct _glushkov_frame{
+    const node_t* node;
+    bool expanded;
+} glushkov_frame_t;
+
+// Nullability, first and last positions of a visited node
+typedef struct _glushkov_result{
+    bool nullable;
+    positions_t first;
+    positions_t last;
+} glushkov_result_t;
+
+// Sort key of a state laid out by nfa_layout: its visits, then its breadth-first rank
+typedef struct _layout_key{
+    size_t visits;
+    size_t rank;
+    int state;
+} layout_key_t;
+
 static int nfa_simple(nfa_t*, char);
+static int nfa_set(nfa_t*, const uint64_t*);
 static int nfa_concat(nfa_t* restrict, nfa_t* restrict);
 static int nfa_union(nfa_t* restrict, nfa_t* restrict);
 static int nfa_star(nfa_t*);
 static int nfa_init(nfa_t*, size_t);
+static size_t glushkov_count(const node_t*);
+static int glushkov_visit(glushkov_t*, const node_t*, bool*, positions_t*, positions_t*);
+static int glushkov_walk(glushkov_t*, const node_t*, glushkov_frame_t*, glushkov_result_t*, size_t*);
+static int glushkov_leaf(glushkov_t*, const node_t*, glushkov_result_t*);
+static int glushkov_combine(glushkov_t*, const node_t*, glushkov_result_t*, size_t*);
+static int glushkov_follow(glushkov_t*, const positions_t*, const positions_t*);
+static int positions_join(positions_t*, positions_t*, positions_t*, bool);
 static void nfa_deinit(nfa_t*);
 static int nfa_state_init(state_t*, bool);
 static void nfa_state_deinit(state_t*);
 static int nfa_state_addsymbol(state_t*, char, int);
 static int nfa_state_extend(state_t*);
-static int nfa_delta(nfa_t*, char);
+static int nfa_state_compact(state_t*, const bool*);
+static int nfa_live_states(const nfa_t*, bool*);
+static void nfa_state_dedup(state_t*);
+static int nfa_bisimulation(const nfa_t*, bool, int*, size_t*);
+static size_t bisimulation_group(const uint64_t*, const size_t*, const size_t*, size_t, int*, size_t, int*);
+static int signature_compare(const void*, const void*);
+static int nfa_quotient(nfa_t*, const int*, size_t);
+static int layout_compare(const void*, const void*);
+static void match_visit(const match_t*, size_t*);
+static size_t nfa_transitions_len(const nfa_t*);
+static size_t nfa_state_rank(const state_t*, size_t);
+static size_t nfa_step(const nfa_t*, const int*, size_t, int*, int*, char);
+static inline void states_insert(int*, int*, size_t*, int);
+static bool states_final(const nfa_t*, const int*, size_t);
+static void classes_refine(unsigned char*, size_t*, const uint64_t*);
+static inline size_t file_align(size_t);
+static uint64_t file_checksum(const unsigned char*, size_t);
+static bool file_fits(const file_header_t*, uint64_t, uint64_t, size_t);
+static int file_map(const char*, const file_header_t**);
+static int file_nfa(const file_header_t*, size_t, nfa_t*);
+static int file_collection(const file_header_t*, nfa_t**, size_t*);
+static bool file_row_valid(const state_t*, size_t, size_t);
+static int nfa_state_indexed(const state_t*, state_t*, const bool*);
+static size_t nfa_state_row_len(const state_t*);
+static int nfa_parallel_init(nfa_t*);
+static void nfa_parallel_deinit(nfa_t*);
+static bool nfa_parallel_accepts(const nfa_parallel_t*, const char*);
+static bool nfa_parallel_step(const nfa_parallel_t*, uint64_t*, char);
+static bool nfa_parallel_final(const nfa_parallel_t*, const uint64_t*);
 
 /*** EXPORTED ***/
 
@@ -34,6 +171,10 @@ int nfa_build(nfa_t* nfa_left, const node_t* parse_tree){
             ERROR_RETHROW(nfa_simple(nfa_left, parse_tree->c));
             break;
 
+        case SET:
+            ERROR_RETHROW(nfa_set(nfa_left, parse_tree->set));
+            break;
+
         case CONCAT:
 
             //check on the integrity of the parse tree
@@ -75,656 +216,3029 @@ int nfa_build(nfa_t* nfa_left, const node_t* parse_tree){
     return OK;
 }
 
-int nfa_accepts(nfa_t* nfa, const char* string, bool* result){
-    *result = false;
+int nfa_build_glushkov(nfa_t* nfa, const node_t* parse_tree)
+{
+    #ifdef _DEBUG
+    assert(nfa != NULL);
+    assert(parse_tree != NULL);
+    #endif
 
-    size_t i;
-    if ((nfa->current_states = malloc(sizeof(int) * nfa->states_len)) == NULL)
+    size_t n = glushkov_count(parse_tree);
+
+    glushkov_t g;
+    g.positions_len = 0;
+    g.edges_len = 0;
+    g.edges_capacity = 0;
+    g.edges = NULL;
+
+    if ((g.labels = calloc(n + 1, sizeof(g.labels[0]))) == NULL)
     {
         return BAD_ALLOCATION;
     }
 
-    nfa->current_states_capacity = nfa->states_len;
+    // FIRST, LAST AND FOLLOW in one traversal
+    bool nullable;
+    positions_t first, last;
+    ERROR_RETHROW(
+        glushkov_visit(&g, parse_tree, &nullable, &first, &last),
+        free(g.labels); free(g.edges)
+    );
 
-    // INITIAL STATE
-    nfa->current_states[0] = 0;
-    nfa->current_states_len = 1;
-    
-    for (i=0; string[i] != '\0'; ++i)
+    // the initial state precedes the first positions
+    int initial_list[1] = {0};
+    positions_t initial = {1, initial_list};
+    ERROR_RETHROW(
+        glushkov_follow(&g, &initial, &first),
+        free(first.list); free(last.list); free(g.labels); free(g.edges)
+    );
+
+    // GROUP THE EDGES BY SOURCE: bucket p of targets is [offsets[p], offsets[p+1])
+    size_t n_states = g.positions_len + 1;
+    size_t* offsets;
+    int* targets;
+    int* seen;
+
+    if ((offsets = calloc(n_states + 1, sizeof(size_t))) == NULL)
     {
-        ERROR_RETHROW(
-            nfa_delta(nfa, string[i]),
-            free(nfa->current_states)
-        );  
+        free(first.list); free(last.list); free(g.labels); free(g.edges);
+        return BAD_ALLOCATION;
     }
 
-    for (i=0; i < nfa->current_states_len; ++i)
+    if ((targets = malloc(sizeof(int) * (g.edges_len + n_states))) == NULL)
     {
-
-        int idx = nfa->current_states[i];
-        if (nfa->states[idx].final)
-        {
-            *result = true;
-        }
+        free(offsets); free(first.list); free(last.list); free(g.labels); free(g.edges);
+        return BAD_ALLOCATION;
     }
+    seen = targets + g.edges_len;
 
-    free(nfa->current_states);
-    return OK;
-}
-
-
-void nfa_destroy(nfa_t* nfa){
-
-    if (nfa == NULL)
+    size_t e;
+    for (e=0; e<g.edges_len; ++e)
     {
-        return;
+        ++offsets[g.edges[e * 2] + 1];
     }
 
     size_t i;
-    for (i=0; i<nfa->states_len; ++i)
+    for (i=0; i<n_states; ++i)
     {
-        nfa_state_deinit(&nfa->states[i]);
+        offsets[i + 1] += offsets[i];
     }
-    
-    nfa_deinit(nfa);
-}
-
-/* DEBUGGING */
 
-int nfa_graph(const nfa_t* nfa){
-	FILE* f;
-	if ( (f = fopen("nfa_graph.gv", "w")) == NULL)
-		return -1;
-	
-	fputs("digraph G{", f);
-	size_t i;
-    for (i=0; i<nfa->states_len; ++i){
-        const char* bgcolor = (nfa->states[i].final) ? "red" : "white";
-        fprintf(f, "%lu [label=\"%lu\", style=\"filled\", fillcolor=\"%s\", shape=\"oval\"]\n", i, i, bgcolor);
-        
-        size_t j;
-        for (j=0; j<nfa->states[i].len; ++j){
-            fprintf(f, "%lu -> %d [label=\"%c\"]\n", i, nfa->states[i].mapped_state[j], nfa->states[i].charset[j]);
-        }
+    for (e=0; e<g.edges_len; ++e)
+    {
+        targets[offsets[g.edges[e * 2]]++] = g.edges[e * 2 + 1];
     }
-	fputs("}", f);
-	
-	fclose(f);
-    return 0;
-}
 
-void nfa_compare(const nfa_t* restrict nfa1, const nfa_t* restrict nfa2)
-{
-    if (nfa1->states_len != nfa2->states_len)
+    // the scatter moved every offset to the next bucket
+    for (i=n_states; i>0; --i)
     {
-        fprintf(stderr, "different: %s @ line %d\n", __FILE__, __LINE__);
-        return;
+        offsets[i] = offsets[i - 1];
     }
+    offsets[0] = 0;
 
-    size_t i;
-    for (i=0; i<nfa1->states_len; ++i)
+    free(g.edges);
+    g.edges = NULL;
+
+    // EMIT THE AUTOMATON: state p is entered on the characters of position p
+    nfa_t temp;
+    ERROR_RETHROW(
+        nfa_init(&temp, n_states),
+        free(offsets); free(targets); free(first.list); free(last.list); free(g.labels)
+    );
+
+    // a star of a star adds the same edges twice: duplicates are dropped (-1),
+    // then every state gets exactly the room for its transitions
+    memset(seen, -1, sizeof(int) * n_states);
+
+    size_t k;
+    for (i=0; i<n_states; ++i)
     {
-        if (nfa1->states[i].len != nfa2->states[i].len)
+        state_t* state = &temp.states[i];
+        for (k=offsets[i]; k<offsets[i + 1]; ++k)
         {
-            fprintf(stderr, "different: %s @ line %d @ iteration %lu\n", __FILE__, __LINE__, i);
-            return;
+            int q = targets[k];
+            if (seen[q] == (int) i)
+            {
+                targets[k] = -1;
+                continue;
+            }
+
+            seen[q] = (int) i;
+            state->capacity += (size_t) __builtin_popcountll(g.labels[q][0]) + (size_t) __builtin_popcountll(g.labels[q][1]);
         }
 
-        size_t j;
-        for (j=0; j<nfa1->states[i].len; ++j)
+        if (state->capacity == 0)
         {
-            if (nfa1->states[i].charset[j] != nfa2->states[i].charset[j])
+            state->capacity = 1;
+        }
+
+        state->charset = malloc(sizeof(char) * state->capacity);
+        state->mapped_state = malloc(sizeof(int) * state->capacity);
+
+        if (state->charset == NULL || state->mapped_state == NULL)
+        {
+            nfa_destroy(&temp); free(offsets); free(targets); free(first.list); free(last.list); free(g.labels);
+            return BAD_ALLOCATION;
+        }
+
+        for (k=offsets[i]; k<offsets[i + 1]; ++k)
+        {
+            int q = targets[k];
+            if (q == -1)
             {
-                fprintf(stderr, "different: %s @ line %d @ iteration %lu\n", __FILE__, __LINE__, j);
-                return;
+                continue;
             }
 
-            if (nfa1->states[i].mapped_state[j] != nfa2->states[i].mapped_state[j])
+            size_t w;
+            for (w=0; w<SYMBOLS_WORDS; ++w)
             {
-                fprintf(stderr, "different: %s @ line %d @ iteration %lu\n", __FILE__, __LINE__, j);
-                return;
+                uint64_t bits = g.labels[q][w];
+                while (bits != 0)
+                {
+                    state->charset[state->len] = (char) (w * 64 + (size_t) __builtin_ctzll(bits));
+                    state->mapped_state[state->len] = q;
+                    ++state->len;
+                    bits &= bits - 1;
+                }
             }
         }
     }
 
-    fprintf(stderr, "NFA1 == NFA2\n");
+    temp.states[0].final = nullable;
+    for (i=0; i<last.len; ++i)
+    {
+        temp.states[last.list[i]].final = true;
+    }
 
+    free(offsets);
+    free(targets);
+    free(first.list);
+    free(last.list);
+    free(g.labels);
+
+    *nfa = temp;
+    return OK;
 }
 
-// Serialize Object and save
-int nfa_collection_save(const nfa_t* nfa, size_t count, const char* filename)
-{
-    #ifdef _DEBUG
-    assert(nfa != NULL);
-    assert(filename != NULL);
-    assert(count > 0);
-    #endif
+int nfa_accepts(const nfa_t* nfa, const char* string, bool* result){
+    *result = false;
 
-    // Open file
-    int fd;
-    if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) < 0)
+    if (nfa->parallel != NULL)
     {
-        return IO_ERROR;
+        *result = nfa_parallel_accepts(nfa->parallel, string);
+        return OK;
     }
 
-    // try to write the length of the collection
-    if (write(fd, &count, sizeof(size_t)) < (ssize_t) sizeof(size_t))
-    {
-        close(fd);
-        return IO_ERROR;
-    }
+    match_t match;
+    ERROR_RETHROW(match_begin(&match, nfa));
+    ERROR_RETHROW(match_accepts(&match, string, result), match_end(&match));
+    match_end(&match);
+
+    return OK;
+}
+
+int nfa_accepts_batch(const nfa_t* nfa, const char* const* strings, size_t count, bool* results)
+{
+    #ifdef _DEBUG
+    assert(nfa != NULL);
+    assert(strings != NULL || count == 0);
+    #endif
 
-    // for every nfa in the collection
     size_t i;
-    for (i=0; i<count; ++i)
+    if (nfa->parallel != NULL)
     {
-        // try to write the states count for nfa i
-        if (write(fd, &(nfa[i].states_len), sizeof(size_t)) < (ssize_t) sizeof(size_t))
+        for (i=0; i<count; ++i)
         {
-            close(fd);
-            return IO_ERROR;
+            results[i] = nfa_parallel_accepts(nfa->parallel, strings[i]);
         }
 
-        // for every state in nfa i
-        size_t j;
-        for (j=0; j<nfa[i].states_len; ++j)
-        {
-            // try to write the length of the charset for that state
-            if (write(fd, &(nfa[i].states[j].len), sizeof(size_t)) < (ssize_t) sizeof(size_t))
-            {
-                close(fd);
-                return IO_ERROR;
-            }
-
-            if (nfa[i].states[j].len > 0)
-            {
-
-                // try to write the charset
-                if (write(fd, nfa[i].states[j].charset, sizeof(char) * nfa[i].states[j].len) < (ssize_t) (sizeof(char) * nfa[i].states[j].len))
-                {
-                    close(fd);
-                    return IO_ERROR;
-                }
+        return OK;
+    }
 
-                // try to write the mapped states
-                if (write(fd, nfa[i].states[j].mapped_state, sizeof(int) * nfa[i].states[j].len) < (ssize_t) (sizeof(int) * nfa[i].states[j].len))
-                {
-                    close(fd);
-                    return IO_ERROR;
-                }
-            }
+    // the state sets are allocated once for the whole batch
+    match_t match;
+    ERROR_RETHROW(match_begin(&match, nfa));
 
-            // try to write the finality of the state
-            if (write(fd, &(nfa[i].states[j].final), sizeof(bool)) < (ssize_t) sizeof(bool))
-            {
-                close(fd);
-                return IO_ERROR;
-            }
-        }
+    for (i=0; i<count; ++i)
+    {
+        ERROR_RETHROW(match_accepts(&match, strings[i], &results[i]), match_end(&match));
     }
-    
 
-    close(fd);
+    match_end(&match);
     return OK;
 }
 
-void nfa_collection_delete(nfa_t* nfa_list, size_t len)
+int nfa_compact(nfa_t* nfa)
 {
     #ifdef _DEBUG
-    assert(nfa_list != NULL);
+    assert(nfa != NULL);
     #endif
 
-    size_t i;                                           
-    for (i=0; i<len; ++i)                             
-    {                                                   
-        size_t j;
-        for (j=0; j<nfa_list[i].states_len; ++j)
-        {
-            nfa_state_deinit(&(nfa_list[i].states[j]));
-        }
-    
-        free(nfa_list[i].states);                         
-    }                   
-                                    
-    free(nfa_list);                                   
+    // THE TRANSITIONS TO DEAD STATES ARE LEFT OUT, SO THAT A MATCH ENDS AS SOON AS NO LIVE STATE REMAINS
+    bool* live;
+    if ((live = malloc(sizeof(bool) * nfa->states_len)) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+
+    ERROR_RETHROW(nfa_live_states(nfa, live), free(live));
+
+    size_t i;
+    for (i=0; i<nfa->states_len; ++i)
+    {
+        nfa->states[i].dead = !live[i];
+    }
+
+    for (i=0; i<nfa->states_len; ++i)
+    {
+        ERROR_RETHROW(nfa_state_compact(&nfa->states[i], live), free(live));
+    }
+
+    free(live);
+
+    ERROR_RETHROW(nfa_parallel_init(nfa));
+    return OK;
 }
 
-int nfa_collection_load(nfa_t** nfa_collection, size_t* len, const char* filename)
+int nfa_trim(nfa_t* nfa)
 {
     #ifdef _DEBUG
-    assert(nfa_collection != NULL);
-    assert(filename != NULL);
+    assert(nfa != NULL);
+    assert(nfa->mapping == NULL);
     #endif
 
-    // try to open file in reading mode
-    int fd;
-    if ((fd = open(filename, O_RDONLY)) < 0)
-    {
-        return IO_ERROR;
-    }
+    size_t n = nfa->states_len;
+    bool* live;
+    int* renumber;
+    int* stack;
 
-    // try to read 8 bytes for the length of the collection
-    size_t count = 0;
-    if (read(fd, &count, sizeof(size_t)) < (ssize_t) sizeof(size_t))
+    if ((live = malloc(sizeof(bool) * n)) == NULL)
     {
-        close(fd);
-        return IO_ERROR;
+        return BAD_ALLOCATION;
     }
 
-    // if count is 0, some ting wong
-    if (count == 0)
+    if ((renumber = malloc(sizeof(int) * n)) == NULL)
     {
-        close(fd);
-        return INVALID_FORMAT;
+        free(live);
+        return BAD_ALLOCATION;
     }
 
-    // try to allocate a new nfa collection to a temporary pointer
-    nfa_t* temp;
-    if ((temp = calloc(sizeof(nfa_t), count)) == NULL)
+    if ((stack = malloc(sizeof(int) * n)) == NULL)
     {
-        close(fd);
+        free(live);
+        free(renumber);
         return BAD_ALLOCATION;
     }
 
-    size_t i;
-    for (i=0; i<count; ++i)
+    ERROR_RETHROW(nfa_live_states(nfa, live), free(live); free(renumber); free(stack));
+
+    // ACCESSIBLE LIVE STATES: every state on a path to a live state is live itself
+    memset(renumber, -1, sizeof(int) * n);
+    renumber[0] = 0;
+    stack[0] = 0;
+
+    size_t s, j, stack_len = 1;
+    while (stack_len > 0)
     {
-        if (read(fd, &(temp[i].states_len), sizeof(size_t)) < (ssize_t) sizeof(size_t))
+        const state_t* state = &nfa->states[stack[--stack_len]];
+        for (j=0; j<state->len; ++j)
         {
-            close(fd);
-            nfa_collection_delete(temp, count);
-            return IO_ERROR;
+            int t = state->mapped_state[j];
+            if (live[t] && renumber[t] == -1)
+            {
+                renumber[t] = 0;
+                stack[stack_len++] = t;
+            }
         }
+    }
 
-        if (temp[i].states_len == 0)
-        {
-            close(fd);
-            nfa_collection_delete(temp, count);
-            return INVALID_FORMAT;
-        }
-        
-        if ((temp[i].states = calloc(sizeof(state_t), temp[i].states_len)) == NULL)
+    free(live);
+    free(stack);
+
+    // the kept states keep their order
+    size_t kept = 0;
+    for (s=0; s<n; ++s)
+    {
+        if (renumber[s] != -1)
         {
-            close(fd);
-            nfa_collection_delete(temp, count);
-            return BAD_ALLOCATION;
+            renumber[s] = (int) kept++;
         }
+    }
 
-        size_t j;
-        for (j=0; j<temp[i].states_len; ++j)
-        {
+    if (kept == n)
+    {
+        free(renumber);
+        return OK;
+    }
 
-            if (read(fd, &(temp[i].states[j].len), sizeof(size_t)) < (ssize_t) sizeof(size_t))
-            {
-                close(fd);
-                nfa_collection_delete(temp, count);
-                return IO_ERROR;
-            }
+    state_t* states;
+    int* tags = NULL;
 
-            if (temp[i].states[j].len > 0)
-            {
-                if ((temp[i].states[j].charset = calloc(sizeof(char), (temp[i].states[j].len))) == NULL)
-                {
-                    close(fd);
-                    nfa_collection_delete(temp, count);
-                    return BAD_ALLOCATION;
-                }
+    if ((states = calloc(kept, sizeof(state_t))) == NULL)
+    {
+        free(renumber);
+        return BAD_ALLOCATION;
+    }
 
-                if ((temp[i].states[j].mapped_state = calloc(sizeof(int), (temp[i].states[j].len))) == NULL)
-                {
-                    close(fd);
-                    nfa_collection_delete(temp, count);
-                    return BAD_ALLOCATION;
-                }
+    if (nfa->tags != NULL && (tags = malloc(sizeof(int) * kept)) == NULL)
+    {
+        free(states);
+        free(renumber);
+        return BAD_ALLOCATION;
+    }
 
-                if (read(fd, temp[i].states[j].charset, sizeof(char) * (temp[i].states[j].len)) < (ssize_t) (sizeof(char) * (temp[i].states[j].len)))
-                {
-                    close(fd);
-                    nfa_collection_delete(temp, count);
-                    return IO_ERROR;
-                }
+    // MOVE THE KEPT STATES, DROPPING THEIR TRANSITIONS TO THE OTHERS
+    for (s=0; s<n; ++s)
+    {
+        if (renumber[s] == -1)
+        {
+            nfa_state_deinit(&nfa->states[s]);
+            continue;
+        }
 
-                if (read(fd, temp[i].states[j].mapped_state, sizeof(int) * (temp[i].states[j].len)) < (ssize_t) (sizeof(int) * (temp[i].states[j].len)))
-                {
-                    close(fd);
-                    nfa_collection_delete(temp, count);
-                    return IO_ERROR;
-                }
+        state_t* state = &states[renumber[s]];
+        *state = nfa->states[s];
 
-            }
+        #ifdef _DEBUG
+        assert(state->len == 0 || state->capacity > 0);
+        #endif
 
-            if (read(fd, &(temp[i].states[j].final), sizeof(bool)) < (ssize_t) sizeof(bool))
+        size_t len = 0;
+        for (j=0; j<state->len; ++j)
+        {
+            int t = renumber[state->mapped_state[j]];
+            if (t != -1)
             {
-                close(fd);
-                nfa_collection_delete(temp, count);
-                return IO_ERROR;
+                state->charset[len] = state->charset[j];
+                state->mapped_state[len] = t;
+                ++len;
             }
-
-            temp[i].states[j].capacity = temp[i].states[j].len;
         }
 
-        temp->current_states = NULL;
-        temp->current_states_len = 0;
-        temp->current_states_capacity = 0;
+        state->len = len;
+
+        // the dense index no longer matches the transitions
+        free(state->row);
+        state->row = NULL;
+        state->deterministic = false;
+        state->dead = false;
+        memset(state->symbols, 0, sizeof(state->symbols));
+
+        if (tags != NULL)
+        {
+            tags[renumber[s]] = nfa->tags[s];
+        }
     }
 
+    free(renumber);
+
+    nfa_parallel_deinit(nfa);
+
+    free(nfa->states);
+    free(nfa->tags);
+
+    nfa->states = states;
+    nfa->tags = tags;
+    nfa->states_len = kept;
+    return OK;
+}
+
+int nfa_reduce(nfa_t* nfa)
+{
+    #ifdef _DEBUG
+    assert(nfa != NULL);
+    assert(nfa->mapping == NULL);
+    #endif
+
+    size_t i;
+    for (i=0; i<nfa->states_len; ++i)
+    {
+        #ifdef _DEBUG
+        assert(nfa->states[i].len == 0 || nfa->states[i].capacity > 0);
+        #endif
+
+        nfa_state_dedup(&nfa->states[i]);
+    }
+
+    int* block;
+    if ((block = malloc(sizeof(int) * nfa->states_len)) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+
+    // ALTERNATE THE FORWARD AND THE BACKWARD QUOTIENTS UNTIL NEITHER MERGES ANY STATE
+    bool backward = false;
+    size_t unchanged = 0;
+    while (unchanged < 2)
+    {
+        size_t blocks_len;
+        ERROR_RETHROW(nfa_bisimulation(nfa, backward, block, &blocks_len), free(block));
+
+        if (blocks_len == nfa->states_len)
+        {
+            ++unchanged;
+        }
+        else
+        {
+            unchanged = 0;
+            ERROR_RETHROW(nfa_quotient(nfa, block, blocks_len), free(block));
+        }
+
+        backward = !backward;
+    }
+
+    free(block);
+    return OK;
+}
+
+int nfa_layout(nfa_t* nfa, const size_t* visits)
+{
+    #ifdef _DEBUG
+    assert(nfa != NULL);
+    assert(nfa->mapping == NULL);
+    #endif
+
+    size_t n = nfa->states_len;
+    layout_key_t* keys;
+    int* renumber;
+
+    if ((keys = malloc(sizeof(layout_key_t) * n)) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+
+    if ((renumber = malloc(sizeof(int) * n)) == NULL)
+    {
+        free(keys);
+        return BAD_ALLOCATION;
+    }
+
+    // BREADTH-FIRST ORDER FROM THE INITIAL STATE, THE UNREACHABLE STATES LAST
+    memset(renumber, -1, sizeof(int) * n);
+    renumber[0] = 0;
+    keys[0].state = 0;
+
+    size_t s, j, head = 0, len = 1;
+    while (len < n)
+    {
+        if (head == len)
+        {
+            // the queue ran out: the first unreachable state goes on
+            for (s=0; renumber[s] != -1; ++s);
+            renumber[s] = (int) len;
+            keys[len++].state = (int) s;
+        }
+
+        const state_t* state = &nfa->states[keys[head++].state];
+        for (j=0; j<state->len; ++j)
+        {
+            int t = state->mapped_state[j];
+            if (renumber[t] == -1)
+            {
+                renumber[t] = (int) len;
+                keys[len++].state = t;
+            }
+        }
+    }
+
+    // THE MOST VISITED STATES FIRST, IN BREADTH-FIRST ORDER AMONG EQUALS
+    if (visits != NULL)
+    {
+        for (s=0; s<n; ++s)
+        {
+            keys[s].rank = s;
+            keys[s].visits = (keys[s].state == 0) ? SIZE_MAX : visits[keys[s].state];
+        }
+
+        qsort(keys, n, sizeof(layout_key_t), layout_compare);
+
+        for (s=0; s<n; ++s)
+        {
+            renumber[keys[s].state] = (int) s;
+        }
+    }
+
+    free(keys);
+
+    #ifdef _DEBUG
+    assert(renumber[0] == 0);
+    #endif
+
+    // a quotient by a permutation only renumbers the states
+    ERROR_RETHROW(nfa_quotient(nfa, renumber, n), free(renumber));
+    free(renumber);
+
+    return OK;
+}
+
+int nfa_profile(const nfa_t* nfa, const char* const* strings, size_t count, size_t* visits)
+{
+    #ifdef _DEBUG
+    assert(nfa != NULL);
+    assert(strings != NULL || count == 0);
+    assert(visits != NULL);
+    #endif
+
+    match_t match;
+    ERROR_RETHROW(match_begin(&match, nfa));
+
+    size_t i, j;
+    for (i=0; i<count; ++i)
+    {
+        match_reset(&match);
+        match_visit(&match, visits);
+
+        for (j=0; strings[i][j] != '\0' && !match_is_dead(&match); ++j)
+        {
+            match_feed(&match, strings[i][j]);
+            match_visit(&match, visits);
+        }
+    }
+
+    match_end(&match);
+    return OK;
+}
+
+int match_begin(match_t* match, const nfa_t* nfa)
+{
+    #ifdef _DEBUG
+    assert(match != NULL);
+    assert(nfa != NULL);
+    assert(nfa->states_len > 0);
+    #endif
+
+    match->nfa = nfa;
+    match->states = NULL;
+    match->next_states = NULL;
+    match->sparse_states = NULL;
+
+    // the bit-parallel simulation needs no state sets
+    if (nfa->parallel == NULL)
+    {
+        if ((match->states = malloc(sizeof(int) * nfa->states_len)) == NULL
+            || (match->next_states = malloc(sizeof(int) * nfa->states_len)) == NULL
+            || (match->sparse_states = calloc(nfa->states_len, sizeof(int))) == NULL)
+        {
+            match_end(match);
+            return BAD_ALLOCATION;
+        }
+    }
+
+    match_reset(match);
+    return OK;
+}
+
+void match_reset(match_t* match)
+{
+    if (match->nfa->parallel != NULL)
+    {
+        memset(match->parallel_states, 0, sizeof(match->parallel_states));
+        match->parallel_states[0] = 1;
+    }
+    else
+    {
+        match->states[0] = 0;
+    }
+
+    match->states_len = 1;
+}
+
+void match_feed(match_t* match, char c)
+{
+    if (match->states_len == 0)
+    {
+        return;
+    }
+
+    if (match->nfa->parallel != NULL)
+    {
+        match->states_len = nfa_parallel_step(match->nfa->parallel, match->parallel_states, c) ? 1 : 0;
+        return;
+    }
+
+    match->states_len = nfa_step(
+        match->nfa, match->states, match->states_len,
+        match->next_states, match->sparse_states, c
+    );
+
+    int* temp = match->states;
+    match->states = match->next_states;
+    match->next_states = temp;
+}
+
+bool match_is_accepting(const match_t* match)
+{
+    if (match->states_len == 0)
+    {
+        return false;
+    }
+
+    if (match->nfa->parallel != NULL)
+    {
+        return nfa_parallel_final(match->nfa->parallel, match->parallel_states);
+    }
+
+    return states_final(match->nfa, match->states, match->states_len);
+}
+
+int match_accepts(match_t* match, const char* string, bool* result)
+{
+    #ifdef _DEBUG
+    assert(match != NULL);
+    assert(string != NULL);
+    #endif
+
+    match_reset(match);
+
+    size_t i;
+    for (i=0; string[i] != '\0' && match->states_len > 0; ++i)
+    {
+        match_feed(match, string[i]);
+    }
+
+    *result = match_is_accepting(match);
+    return OK;
+}
+
+bool match_is_dead(const match_t* match)
+{
+    return match->states_len == 0;
+}
+
+void match_end(match_t* match)
+{
+    free(match->states);
+    free(match->next_states);
+    free(match->sparse_states);
+
+    match->states = NULL;
+    match->next_states = NULL;
+    match->sparse_states = NULL;
+    match->states_len = 0;
+}
+
+void nfa_destroy(nfa_t* nfa){
+
+    if (nfa == NULL)
+    {
+        return;
+    }
+
+    size_t i;
+    for (i=0; i<nfa->states_len; ++i)
+    {
+        nfa_state_deinit(&nfa->states[i]);
+    }
+    
+    nfa_deinit(nfa);
+}
+
+/* DEBUGGING */
+
+int nfa_graph(const nfa_t* nfa){
+	FILE* f;
+	if ( (f = fopen("nfa_graph.gv", "w")) == NULL)
+		return -1;
+	
+	fputs("digraph G{", f);
+	size_t i;
+    for (i=0; i<nfa->states_len; ++i){
+        const char* bgcolor = (nfa->states[i].final) ? "red" : "white";
+        fprintf(f, "%lu [label=\"%lu\", style=\"filled\", fillcolor=\"%s\", shape=\"oval\"]\n", i, i, bgcolor);
+        
+        size_t j;
+        for (j=0; j<nfa->states[i].len; ++j){
+            fprintf(f, "%lu -> %d [label=\"%c\"]\n", i, nfa->states[i].mapped_state[j], nfa->states[i].charset[j]);
+        }
+    }
+	fputs("}", f);
+	
+	fclose(f);
+    return 0;
+}
+
+void nfa_compare(const nfa_t* restrict nfa1, const nfa_t* restrict nfa2)
+{
+    fprintf(stderr, "NFA1: %lu states, %lu transitions; NFA2: %lu states, %lu transitions\n",
+        nfa1->states_len, nfa_transitions_len(nfa1), nfa2->states_len, nfa_transitions_len(nfa2));
+
+    if (nfa1->states_len != nfa2->states_len)
+    {
+        fprintf(stderr, "different: %s @ line %d\n", __FILE__, __LINE__);
+        return;
+    }
+
+    size_t i;
+    for (i=0; i<nfa1->states_len; ++i)
+    {
+        if (nfa1->states[i].len != nfa2->states[i].len)
+        {
+            fprintf(stderr, "different: %s @ line %d @ iteration %lu\n", __FILE__, __LINE__, i);
+            return;
+        }
+
+        size_t j;
+        for (j=0; j<nfa1->states[i].len; ++j)
+        {
+            if (nfa1->states[i].charset[j] != nfa2->states[i].charset[j])
+            {
+                fprintf(stderr, "different: %s @ line %d @ iteration %lu\n", __FILE__, __LINE__, j);
+                return;
+            }
+
+            if (nfa1->states[i].mapped_state[j] != nfa2->states[i].mapped_state[j])
+            {
+                fprintf(stderr, "different: %s @ line %d @ iteration %lu\n", __FILE__, __LINE__, j);
+                return;
+            }
+        }
+    }
+
+    fprintf(stderr, "NFA1 == NFA2\n");
+
+}
+
+// Serialize Object and save
+int nfa_collection_save(const nfa_t* nfa, size_t count, const char* filename)
+{
+    #ifdef _DEBUG
+    assert(nfa != NULL);
+    assert(filename != NULL);
+    assert(count > 0);
+    #endif
+
+    // the union of the collection, tagged with the index of the matching NFA, follows it
+    nfa_t merged;
+    ERROR_RETHROW(nfa_collection_merge(&merged, nfa, count));
+
+    file_header_t header;
+    memset(&header, 0, sizeof(header));
+
+    size_t classes_len;
+    ERROR_RETHROW(
+        nfa_collection_classes(nfa, count, header.class_map, &classes_len),
+        nfa_destroy(&merged)
+    );
+
+    header.magic = NFA_FILE_MAGIC;
+    header.version = NFA_FILE_VERSION;
+    header.endianness = NFA_FILE_ENDIANNESS;
+    header.classes_len = (uint32_t) classes_len;
+    header.nfas_len = count + 1;
+
+    size_t i, j;
+    for (i=0; i<=count; ++i)
+    {
+        header.states_len += (i < count) ? nfa[i].states_len : merged.states_len;
+    }
+
+    // the states of every NFA from which it can still accept, as nfa_compact finds them
+    bool* live;
+    if ((live = malloc(sizeof(bool) * header.states_len)) == NULL)
+    {
+        nfa_destroy(&merged);
+        return BAD_ALLOCATION;
+    }
+
+    // SIZES OF THE ARRAYS
+    size_t states_len = 0;
+    for (i=0; i<=count; ++i)
+    {
+        const nfa_t* current = (i < count) ? &nfa[i] : &merged;
+        ERROR_RETHROW(nfa_live_states(current, live + states_len), free(live); nfa_destroy(&merged));
+
+        for (j=0; j<current->states_len; ++j)
+        {
+            state_t indexed;
+            ERROR_RETHROW(
+                nfa_state_indexed(&current->states[j], &indexed, live + states_len),
+                free(live); nfa_destroy(&merged)
+            );
+
+            header.transitions_len += current->states[j].len;
+            header.rows_len += nfa_state_row_len(&indexed);
+            free(indexed.row);
+        }
+
+        states_len += current->states_len;
+    }
+
+    header.nfas_offset = file_align(sizeof(file_header_t));
+    header.states_offset = file_align(header.nfas_offset + sizeof(file_nfa_t) * header.nfas_len);
+    header.targets_offset = file_align(header.states_offset + sizeof(file_state_t) * header.states_len);
+    header.rows_offset = file_align(header.targets_offset + sizeof(int32_t) * header.transitions_len);
+    header.tags_offset = file_align(header.rows_offset + sizeof(int32_t) * header.rows_len);
+    header.charset_offset = file_align(header.tags_offset + sizeof(int32_t) * merged.states_len);
+    header.file_len = header.charset_offset + header.transitions_len;
+
+    // THE WHOLE FILE IS BUILT IN MEMORY, THEN WRITTEN AT ONCE
+    unsigned char* image;
+    if ((image = calloc(header.file_len, sizeof(unsigned char))) == NULL)
+    {
+        free(live);
+        nfa_destroy(&merged);
+        return BAD_ALLOCATION;
+    }
+
+    file_nfa_t* nfas = (file_nfa_t*) (image + header.nfas_offset);
+    file_state_t* states = (file_state_t*) (image + header.states_offset);
+    int32_t* targets = (int32_t*) (image + header.targets_offset);
+    int32_t* rows = (int32_t*) (image + header.rows_offset);
+    char* charset = (char*) (image + header.charset_offset);
+
+    size_t transitions_len = 0, rows_len = 0;
+    states_len = 0;
+    for (i=0; i<=count; ++i)
+    {
+        const nfa_t* current = (i < count) ? &nfa[i] : &merged;
+        nfas[i].states = states_len;
+        nfas[i].states_len = current->states_len;
+
+        for (j=0; j<current->states_len; ++j)
+        {
+            const state_t* state = &current->states[j];
+            file_state_t* record = &states[states_len++];
+
+            state_t indexed;
+            ERROR_RETHROW(
+                nfa_state_indexed(state, &indexed, live + nfas[i].states),
+                free(image); free(live); nfa_destroy(&merged)
+            );
+
+            memcpy(record->symbols, indexed.symbols, sizeof(record->symbols));
+            record->transitions = transitions_len;
+            record->row = rows_len;
+            record->len = (uint32_t) state->len;
+            record->row_len = (uint32_t) nfa_state_row_len(&indexed);
+            record->final = state->final;
+            record->deterministic = indexed.deterministic;
+            record->dead = !live[nfas[i].states + j];
+
+            if (state->len > 0)
+            {
+                memcpy(charset + transitions_len, state->charset, sizeof(char) * state->len);
+                memcpy(targets + transitions_len, state->mapped_state, sizeof(int32_t) * state->len);
+                transitions_len += state->len;
+            }
+
+            if (record->row_len > 0)
+            {
+                memcpy(rows + rows_len, indexed.row, sizeof(int32_t) * record->row_len);
+                rows_len += record->row_len;
+            }
+
+            free(indexed.row);
+        }
+    }
+
+    memcpy(image + header.tags_offset, merged.tags, sizeof(int32_t) * merged.states_len);
+    nfa_destroy(&merged);
+    free(live);
+
+    header.checksum = file_checksum(image + sizeof(file_header_t), header.file_len - sizeof(file_header_t));
+    memcpy(image, &header, sizeof(header));
+
+    // Open file
+    int fd;
+    if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) < 0)
+    {
+        free(image);
+        return IO_ERROR;
+    }
+
+    size_t written = 0;
+    while (written < header.file_len)
+    {
+        ssize_t n;
+        if ((n = write(fd, image + written, header.file_len - written)) <= 0)
+        {
+            close(fd);
+            free(image);
+            return IO_ERROR;
+        }
+
+        written += (size_t) n;
+    }
+
+    close(fd);
+    free(image);
+    return OK;
+}
+
+int nfa_collection_load_merged(nfa_t* merged, const char* filename)
+{
+    #ifdef _DEBUG
+    assert(merged != NULL);
+    assert(filename != NULL);
+    #endif
+
+    const file_header_t* header;
+    ERROR_RETHROW(file_map(filename, &header));
+
+    // the merged NFA is the last of the file
+    nfa_t temp;
+    ERROR_RETHROW(
+        file_nfa(header, header->nfas_len - 1, &temp),
+        munmap((void*) header, header->file_len)
+    );
+
+    temp.mapping = (void*) header;
+    temp.mapping_len = header->file_len;
+
+    *merged = temp;
+    return OK;
+}
+
+int nfa_collection_merge(nfa_t* merged, const nfa_t* nfa, size_t count)
+{
+    #ifdef _DEBUG
+    assert(merged != NULL);
+    assert(nfa != NULL);
+    assert(count > 0);
+    #endif
+
+    // a new initial state, followed by the states of every NFA in order
+    size_t states_len = 1;
+    size_t i;
+    for (i=0; i<count; ++i)
+    {
+        states_len += nfa[i].states_len;
+    }
+
+    nfa_t temp;
+    ERROR_RETHROW(nfa_init(&temp, states_len));
+
+    if ((temp.tags = malloc(sizeof(int) * states_len)) == NULL)
+    {
+        nfa_destroy(&temp);
+        return BAD_ALLOCATION;
+    }
+
+    ERROR_RETHROW(nfa_state_init(&temp.states[0], false), nfa_destroy(&temp));
+    temp.tags[0] = NFA_NO_TAG;
+
+    size_t offset = 1;
+    for (i=0; i<count; ++i)
+    {
+        size_t j, k;
+        for (j=0; j<nfa[i].states_len; ++j)
+        {
+            const state_t* state = &nfa[i].states[j];
+            state_t* copy = &temp.states[offset + j];
+
+            ERROR_RETHROW(nfa_state_init(copy, state->final), nfa_destroy(&temp));
+            temp.tags[offset + j] = state->final ? (int) i : NFA_NO_TAG;
+
+            for (k=0; k<state->len; ++k)
+            {
+                ERROR_RETHROW(
+                    nfa_state_addsymbol(copy, state->charset[k], state->mapped_state[k] + (int) offset),
+                    nfa_destroy(&temp)
+                );
+            }
+        }
+
+        // THE NEW INITIAL STATE GETS THE TRANSITIONS OF EVERY INITIAL STATE
+        const state_t* initial = &nfa[i].states[0];
+        for (k=0; k<initial->len; ++k)
+        {
+            ERROR_RETHROW(
+                nfa_state_addsymbol(&temp.states[0], initial->charset[k], initial->mapped_state[k] + (int) offset),
+                nfa_destroy(&temp)
+            );
+        }
+
+        // the earlier NFAs have the priority on the empty string
+        if (initial->final && !temp.states[0].final)
+        {
+            temp.states[0].final = true;
+            temp.tags[0] = (int) i;
+        }
+
+        offset += nfa[i].states_len;
+    }
+
+    *merged = temp;
+    return OK;
+}
+
+int nfa_collection_classes(const nfa_t* nfa, size_t count, unsigned char* class_map, size_t* classes_len)
+{
+    #ifdef _DEBUG
+    assert(nfa != NULL);
+    assert(class_map != NULL);
+    #endif
+
+    // every byte starts in the same class, then the characters leading from a state
+    // to the same target split the classes they only partially cover
+    size_t len = 1;
+    memset(class_map, 0, ASCII_LEN);
+
+    size_t i;
+    for (i=0; i<count; ++i)
+    {
+        uint64_t* sets;
+        int* targets;
+
+        if ((sets = calloc(nfa[i].states_len * SYMBOLS_WORDS, sizeof(uint64_t))) == NULL)
+        {
+            return BAD_ALLOCATION;
+        }
+
+        if ((targets = malloc(sizeof(int) * nfa[i].states_len)) == NULL)
+        {
+            free(sets);
+            return BAD_ALLOCATION;
+        }
+
+        size_t j;
+        for (j=0; j<nfa[i].states_len; ++j)
+        {
+            const state_t* state = &nfa[i].states[j];
+            size_t targets_len = 0;
+
+            // GROUP THE CHARACTERS BY TARGET
+            size_t k;
+            for (k=0; k<state->len; ++k)
+            {
+                size_t uc = (unsigned char) state->charset[k];
+                uint64_t* set = &sets[(size_t) state->mapped_state[k] * SYMBOLS_WORDS];
+
+                if (uc >= ASCII_LEN)
+                {
+                    continue;
+                }
+
+                if (set[0] == 0 && set[1] == 0)
+                {
+                    targets[targets_len++] = state->mapped_state[k];
+                }
+
+                set[uc / 64] |= (uint64_t) 1 << (uc % 64);
+            }
+
+            for (k=0; k<targets_len; ++k)
+            {
+                uint64_t* set = &sets[(size_t) targets[k] * SYMBOLS_WORDS];
+                classes_refine(class_map, &len, set);
+                set[0] = set[1] = 0;
+            }
+        }
+
+        free(sets);
+        free(targets);
+    }
+
+    // RENUMBER THE CLASSES IN ORDER OF THEIR FIRST BYTE
+    int renumber[ASCII_LEN];
+    memset(renumber, -1, sizeof(renumber));
+
+    size_t c, next = 0;
+    for (c=0; c<ASCII_LEN; ++c)
+    {
+        if (renumber[class_map[c]] == -1)
+        {
+            renumber[class_map[c]] = (int) next++;
+        }
+
+        class_map[c] = (unsigned char) renumber[class_map[c]];
+    }
+
+    *classes_len = len;
+    return OK;
+}
+
+void nfa_collection_delete(nfa_t* nfa_list, size_t len)
+{
+    #ifdef _DEBUG
+    assert(nfa_list != NULL);
+    #endif
+
+    size_t i;                                           
+    for (i=0; i<len; ++i)                             
+    {                                                   
+        size_t j;
+        for (j=0; j<nfa_list[i].states_len; ++j)
+        {
+            nfa_state_deinit(&(nfa_list[i].states[j]));
+        }
+    
+        nfa_parallel_deinit(&nfa_list[i]);
+        free(nfa_list[i].states);                         
+
+        if (nfa_list[i].mapping != NULL)
+        {
+            munmap(nfa_list[i].mapping, nfa_list[i].mapping_len);
+        }
+        else
+        {
+            free(nfa_list[i].tags);
+        }
+    }                   
+                                    
+    free(nfa_list);                                   
+}
+
+int nfa_collection_load(nfa_t** nfa_collection, size_t* len, const char* filename)
+{
+    #ifdef _DEBUG
+    assert(nfa_collection != NULL);
+    assert(filename != NULL);
+    #endif
+
+    const file_header_t* header;
+    ERROR_RETHROW(file_map(filename, &header));
+    ERROR_RETHROW(
+        file_collection(header, nfa_collection, len),
+        munmap((void*) header, header->file_len)
+    );
+
+    return OK;
+}
+
+int nfa_collection_open(nfa_t** nfa_collection, size_t* len, nfa_t* merged, unsigned char* class_map, size_t* classes_len, const char* filename)
+{
+    #ifdef _DEBUG
+    assert(nfa_collection != NULL);
+    assert(merged != NULL);
+    assert(class_map != NULL);
+    assert(filename != NULL);
+    #endif
+
+    const file_header_t* header;
+    ERROR_RETHROW(file_map(filename, &header));
+
+    // the merged NFA is the last of the file
+    nfa_t temp;
+    ERROR_RETHROW(
+        file_nfa(header, header->nfas_len - 1, &temp),
+        munmap((void*) header, header->file_len)
+    );
+
+    // the mapping belongs to the collection, the merged NFA only owns a copy of its tags
+    int* tags;
+    if ((tags = malloc(sizeof(int) * temp.states_len)) == NULL)
+    {
+        nfa_destroy(&temp);
+        munmap((void*) header, header->file_len);
+        return BAD_ALLOCATION;
+    }
+    memcpy(tags, temp.tags, sizeof(int) * temp.states_len);
+    temp.tags = tags;
+
+    ERROR_RETHROW(
+        file_collection(header, nfa_collection, len),
+        nfa_destroy(&temp); munmap((void*) header, header->file_len)
+    );
+
+    memcpy(class_map, header->class_map, sizeof(header->class_map));
+    *classes_len = header->classes_len;
+
+    *merged = temp;
+    return OK;
+}
+
+uint64_t nfa_cache_key(const char* regex, uint32_t options)
+{
+    #ifdef _DEBUG
+    assert(regex != NULL);
+    #endif
+
+    uint32_t prefix[2] = {NFA_BUILDER_VERSION, options};
+    uint64_t hash = 0xcbf29ce484222325u;
+
+    size_t i;
+    for (i=0; i<sizeof(prefix); ++i)
+    {
+        hash = (hash ^ ((const unsigned char*) prefix)[i]) * 0x100000001b3u;
+    }
+
+    for (i=0; regex[i] != '\0'; ++i)
+    {
+        hash = (hash ^ (unsigned char) regex[i]) * 0x100000001b3u;
+    }
+
+    return hash;
+}
+
+int nfa_cache_load(nfa_t* nfa, const char* directory, uint64_t key)
+{
+    #ifdef _DEBUG
+    assert(nfa != NULL);
+    assert(directory != NULL);
+    #endif
+
+    char filename[strlen(directory) + NFA_CACHE_NAME_LEN];
+    snprintf(filename, sizeof(filename), "%s/%016" PRIx64 ".dat", directory, key);
+
+    const file_header_t* header;
+    ERROR_RETHROW(file_map(filename, &header));
+
+    // a single automaton, followed by its merged copy
+    if (header->nfas_len != 2)
+    {
+        munmap((void*) header, header->file_len);
+        return INVALID_FORMAT;
+    }
+
+    nfa_t temp;
+    ERROR_RETHROW(
+        file_nfa(header, 0, &temp),
+        munmap((void*) header, header->file_len)
+    );
+
+    temp.mapping = (void*) header;
+    temp.mapping_len = header->file_len;
+
+    *nfa = temp;
+    return OK;
+}
+
+int nfa_cache_store(const nfa_t* nfa, const char* directory, uint64_t key)
+{
+    #ifdef _DEBUG
+    assert(nfa != NULL);
+    assert(directory != NULL);
+    #endif
+
+    if (mkdir(directory, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) < 0 && errno != EEXIST)
+    {
+        return IO_ERROR;
+    }
+
+    char filename[strlen(directory) + NFA_CACHE_NAME_LEN];
+    char temp_filename[strlen(directory) + NFA_CACHE_NAME_LEN + 16];
+    snprintf(filename, sizeof(filename), "%s/%016" PRIx64 ".dat", directory, key);
+    snprintf(temp_filename, sizeof(temp_filename), "%s.%d", filename, (int) getpid());
+
+    // renamed once complete, so that no build ever loads a partial entry
+    ERROR_RETHROW(nfa_collection_save(nfa, 1, temp_filename), unlink(temp_filename));
+
+    if (rename(temp_filename, filename) < 0)
+    {
+        unlink(temp_filename);
+        return IO_ERROR;
+    }
+
+    return OK;
+}
+
+/*** INTERNAL ***/
+
+// Rounds a file offset up to the alignment of the arrays
+static inline size_t file_align(size_t offset)
+{
+    return (offset + NFA_FILE_ALIGNMENT - 1) & ~((size_t) NFA_FILE_ALIGNMENT - 1);
+}
+
+// FNV-1a hash of the bytes
+static uint64_t file_checksum(const unsigned char* bytes, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325u;
+
+    size_t i;
+    for (i=0; i<len; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3u;
+    }
+
+    return hash;
+}
+
+// Checks that n elements of size bytes at offset lie in the file, aligned
+static bool file_fits(const file_header_t* header, uint64_t offset, uint64_t n, size_t size)
+{
+    return offset % NFA_FILE_ALIGNMENT == 0
+        && offset >= sizeof(file_header_t)
+        && offset <= header->file_len
+        && n <= (header->file_len - offset) / size;
+}
+
+// Maps a collection file in memory, read only, once its header and checksum are checked
+static int file_map(const char* filename, const file_header_t** header)
+{
+    int fd;
+    if ((fd = open(filename, O_RDONLY)) < 0)
+    {
+        return IO_ERROR;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return IO_ERROR;
+    }
+
+    if ((size_t) st.st_size < sizeof(file_header_t))
+    {
+        close(fd);
+        return INVALID_FORMAT;
+    }
+
+    void* mapping;
+    if ((mapping = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    {
+        close(fd);
+        return IO_ERROR;
+    }
+
+    // the mapping outlives the descriptor
+    close(fd);
+
+    const file_header_t* temp = mapping;
+    if (temp->magic != NFA_FILE_MAGIC
+        || temp->version != NFA_FILE_VERSION
+        || temp->endianness != NFA_FILE_ENDIANNESS
+        || temp->file_len != (uint64_t) st.st_size
+        || temp->nfas_len < 2
+        || temp->classes_len == 0 || temp->classes_len > ASCII_LEN
+        || !file_fits(temp, temp->nfas_offset, temp->nfas_len, sizeof(file_nfa_t))
+        || !file_fits(temp, temp->states_offset, temp->states_len, sizeof(file_state_t))
+        || !file_fits(temp, temp->targets_offset, temp->transitions_len, sizeof(int32_t))
+        || !file_fits(temp, temp->rows_offset, temp->rows_len, sizeof(int32_t))
+        || !file_fits(temp, temp->tags_offset, 0, sizeof(int32_t))
+        || !file_fits(temp, temp->charset_offset, temp->transitions_len, sizeof(char))
+        || temp->checksum != file_checksum((const unsigned char*) mapping + sizeof(file_header_t), temp->file_len - sizeof(file_header_t)))
+    {
+        munmap(mapping, (size_t) st.st_size);
+        return INVALID_FORMAT;
+    }
+
+    size_t c;
+    for (c=0; c<ASCII_LEN; ++c)
+    {
+        if (temp->class_map[c] >= temp->classes_len)
+        {
+            munmap(mapping, (size_t) st.st_size);
+            return INVALID_FORMAT;
+        }
+    }
+
+    *header = temp;
+    return OK;
+}
+
+// Builds the k-th NFA of a mapped collection file, its states pointing into the mapping
+static int file_nfa(const file_header_t* header, size_t k, nfa_t* nfa)
+{
+    const unsigned char* base = (const unsigned char*) header;
+    const file_nfa_t* record = (const file_nfa_t*) (base + header->nfas_offset) + k;
+    const file_state_t* records = (const file_state_t*) (base + header->states_offset);
+    int32_t* targets = (int32_t*) (base + header->targets_offset);
+    int32_t* rows = (int32_t*) (base + header->rows_offset);
+    char* charset = (char*) (base + header->charset_offset);
+
+    if (record->states_len == 0
+        || record->states > header->states_len
+        || record->states_len > header->states_len - record->states)
+    {
+        return INVALID_FORMAT;
+    }
+
+    // the merged NFA carries the tags
+    bool tagged = (k == header->nfas_len - 1);
+    if (tagged && !file_fits(header, header->tags_offset, record->states_len, sizeof(int32_t)))
+    {
+        return INVALID_FORMAT;
+    }
+
+    nfa_t temp;
+    ERROR_RETHROW(nfa_init(&temp, record->states_len));
+
+    size_t j;
+    for (j=0; j<temp.states_len; ++j)
+    {
+        const file_state_t* source = &records[record->states + j];
+        state_t* state = &temp.states[j];
+
+        if (source->transitions > header->transitions_len
+            || source->len > header->transitions_len - source->transitions
+            || source->row > header->rows_len
+            || source->row_len > header->rows_len - source->row)
+        {
+            nfa_destroy(&temp);
+            return INVALID_FORMAT;
+        }
+
+        // capacity 0: the transitions are not owned
+        state->len = source->len;
+        state->capacity = 0;
+        state->charset = (source->len > 0) ? charset + source->transitions : NULL;
+        state->mapped_state = (source->len > 0) ? targets + source->transitions : NULL;
+        state->final = source->final;
+        state->deterministic = source->deterministic;
+        state->dead = source->dead;
+        memcpy(state->symbols, source->symbols, sizeof(state->symbols));
+        state->row = (source->row_len > 0) ? rows + source->row : NULL;
+
+        // the targets must be states of this NFA
+        size_t l;
+        for (l=0; l<state->len; ++l)
+        {
+            if (state->mapped_state[l] < 0 || (size_t) state->mapped_state[l] >= temp.states_len)
+            {
+                nfa_destroy(&temp);
+                return INVALID_FORMAT;
+            }
+        }
+
+        if (!file_row_valid(state, source->row_len, temp.states_len))
+        {
+            nfa_destroy(&temp);
+            return INVALID_FORMAT;
+        }
+    }
+
+    ERROR_RETHROW(nfa_parallel_init(&temp), nfa_destroy(&temp));
+
+    if (tagged)
+    {
+        temp.tags = (int*) (base + header->tags_offset);
+    }
+
+    *nfa = temp;
+    return OK;
+}
+
+// Builds every NFA but the merged one of a mapped collection file, the first holding the mapping
+static int file_collection(const file_header_t* header, nfa_t** nfa_collection, size_t* len)
+{
+    size_t count = header->nfas_len - 1;
+
+    // try to allocate a new nfa collection to a temporary pointer
+    nfa_t* temp;
+    if ((temp = calloc(sizeof(nfa_t), count)) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+
+    size_t i;
+    for (i=0; i<count; ++i)
+    {
+        ERROR_RETHROW(file_nfa(header, i, &temp[i]), nfa_collection_delete(temp, count));
+    }
+
+    // the first NFA holds the mapping for the whole collection
+    temp[0].mapping = (void*) header;
+    temp[0].mapping_len = header->file_len;
+
     *nfa_collection = temp;
     *len = count;
+    return OK;
+}
+
+// Checks that the dense index of a mapped state is laid out as nfa_state_compact builds it
+static bool file_row_valid(const state_t* state, size_t row_len, size_t states_len)
+{
+    if (state->row == NULL)
+    {
+        return true;
+    }
+
+    size_t l;
+    if (state->deterministic)
+    {
+        if (row_len != ASCII_LEN)
+        {
+            return false;
+        }
+
+        for (l=0; l<ASCII_LEN; ++l)
+        {
+            if (state->row[l] < -1 || state->row[l] >= (int) states_len)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // OFFSETS FROM 0, NON DECREASING, THEN THE TARGETS
+    size_t m = nfa_state_rank(state, ASCII_LEN);
+    if (row_len < m + 1 || state->row[0] != 0 || state->row[m] < 0 || (size_t) state->row[m] != row_len - m - 1)
+    {
+        return false;
+    }
+
+    for (l=0; l<m; ++l)
+    {
+        if (state->row[l] > state->row[l+1])
+        {
+            return false;
+        }
+    }
+
+    for (l=m+1; l<row_len; ++l)
+    {
+        if (state->row[l] < 0 || state->row[l] >= (int) states_len)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Copies state into indexed, sharing its transitions but with a dense index of its own
+static int nfa_state_indexed(const state_t* state, state_t* indexed, const bool* live)
+{
+    *indexed = *state;
+    indexed->row = NULL;
+
+    return nfa_state_compact(indexed, live);
+}
+
+// Number of ints in the dense index of the state
+static size_t nfa_state_row_len(const state_t* state)
+{
+    if (state->row == NULL)
+    {
+        return 0;
+    }
+
+    if (state->deterministic)
+    {
+        return ASCII_LEN;
+    }
+
+    size_t m = nfa_state_rank(state, ASCII_LEN);
+    return m + 1 + (size_t) state->row[m];
+}
+
+
+// Computes into next_states the successors on c of current_states, returns their number
+static size_t nfa_step(const nfa_t* nfa, const int* current_states, size_t current_states_len, int* next_states, int* sparse_states, char c)
+{
+    size_t next_states_len = 0;
+    size_t uc = (unsigned char) c;
+
+    size_t i;
+    for (i=0; i<current_states_len; ++i){
+        const state_t* state = &nfa->states[current_states[i]];
+
+        if (state->row == NULL)
+        {
+            size_t j;        
+            for (j=0; j<state->len; ++j){
+
+                if (state->charset[j] == c)
+                {
+                    states_insert(next_states, sparse_states, &next_states_len, state->mapped_state[j]);
+                }
+            }
+        }
+        else if (uc < ASCII_LEN)
+        {
+            // DENSE INDEX: DIRECT LOOKUP OR RANK IN THE BITMAP
+            if (state->deterministic)
+            {
+                if (state->row[uc] != -1)
+                {
+                    states_insert(next_states, sparse_states, &next_states_len, state->row[uc]);
+                }
+            }
+            else if (state->symbols[uc / 64] & ((uint64_t) 1 << (uc % 64)))
+            {
+                size_t rank = nfa_state_rank(state, uc);
+                const int* targets = state->row + nfa_state_rank(state, ASCII_LEN) + 1;
+
+                int l;
+                for (l=state->row[rank]; l<state->row[rank+1]; ++l)
+                {
+                    states_insert(next_states, sparse_states, &next_states_len, targets[l]);
+                }
+            }
+        }
+    }
+
+    return next_states_len;
+}
+
+// Adds s to the sparse set unless it is already there
+static inline void states_insert(int* states, int* sparse_states, size_t* states_len, int s)
+{
+    size_t k = (size_t) sparse_states[s];
+    if (k < *states_len && states[k] == s)
+    {
+        return;
+    }
+
+    sparse_states[s] = (int) *states_len;
+    states[(*states_len)++] = s;
+}
+
+static bool states_final(const nfa_t* nfa, const int* states, size_t states_len)
+{
+    size_t i;
+    for (i=0; i<states_len; ++i)
+    {
+        if (nfa->states[states[i]].final)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int nfa_init(nfa_t* nfa, size_t n_states){
+    nfa_t tmp_nfa;
+    
+    if ((tmp_nfa.states = calloc((size_t) n_states, sizeof(state_t))) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+
+    tmp_nfa.states_len = n_states;
+    tmp_nfa.parallel = NULL;
+    tmp_nfa.tags = NULL;
+    tmp_nfa.mapping = NULL;
+    tmp_nfa.mapping_len = 0;
+
+    *nfa = tmp_nfa;
+    return 0;
+}
+
+// Upper bound on the positions of the tree: the character and class leaves of its arena
+static size_t glushkov_count(const node_t* node)
+{
+    size_t count = 0;
+    size_t i;
+    for (i=0; i<node->arena->len; ++i)
+    {
+        if (node->arena->nodes[i].op == NONE || node->arena->nodes[i].op == SET)
+        {
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+// Numbers the positions of node, computes its first and last positions and adds its follow edges
+static int glushkov_visit(glushkov_t* g, const node_t* node, bool* nullable, positions_t* first, positions_t* last)
+{
+    // every node is on the frame stack at most once, and leaves at most one result each
+    size_t capacity = node->arena->len + 1;
+
+    glushkov_frame_t* frames;
+    if ((frames = malloc(sizeof(glushkov_frame_t) * capacity)) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+
+    glushkov_result_t* results;
+    if ((results = malloc(sizeof(glushkov_result_t) * capacity)) == NULL)
+    {
+        free(frames);
+        return BAD_ALLOCATION;
+    }
+
+    size_t results_len = 0;
+    int err;
+    if ((err = glushkov_walk(g, node, frames, results, &results_len)) != OK)
+    {
+        while (results_len > 0)
+        {
+            --results_len;
+            free(results[results_len].first.list);
+            free(results[results_len].last.list);
+        }
+        free(results);
+        free(frames);
+        return err;
+    }
+
+    #ifdef _DEBUG
+    assert(results_len == 1);
+    #endif
+
+    *nullable = results[0].nullable;
+    *first = results[0].first;
+    *last = results[0].last;
+
+    free(results);
+    free(frames);
+    return OK;
+}
+
+// Post-order walk of the tree with an explicit stack: leaves are numbered from left to right,
+// the results of the children are replaced by the one of their parent
+static int glushkov_walk(glushkov_t* g, const node_t* node, glushkov_frame_t* frames, glushkov_result_t* results, size_t* results_len)
+{
+    size_t frames_len = 0;
+    frames[frames_len++] = (glushkov_frame_t){node, false};
+
+    while (frames_len > 0)
+    {
+        glushkov_frame_t frame = frames[--frames_len];
+
+        if (frame.expanded)
+        {
+            ERROR_RETHROW(glushkov_combine(g, frame.node, results, results_len));
+            continue;
+        }
+
+        switch (frame.node->op)
+        {
+            case NONE:
+            case SET:
+                ERROR_RETHROW(glushkov_leaf(g, frame.node, &results[*results_len]));
+                ++*results_len;
+                break;
+
+            case STAR:
+                #ifdef _DEBUG
+                assert(frame.node->l_child != NULL);
+                #endif
+
+                frames[frames_len++] = (glushkov_frame_t){frame.node, true};
+                frames[frames_len++] = (glushkov_frame_t){frame.node->l_child, false};
+                break;
+
+            case CONCAT:
+            case UNION:
+                #ifdef _DEBUG
+                assert(frame.node->l_child != NULL && frame.node->r_child != NULL);
+                #endif
+
+                // the left child is on top, so its positions come first
+                frames[frames_len++] = (glushkov_frame_t){frame.node, true};
+                frames[frames_len++] = (glushkov_frame_t){frame.node->r_child, false};
+                frames[frames_len++] = (glushkov_frame_t){frame.node->l_child, false};
+                break;
+
+            default:
+                return NFA_CORRUPT_TREE;
+        }
+    }
+
+    return OK;
+}
+
+// Numbers the next position with the characters of a leaf
+static int glushkov_leaf(glushkov_t* g, const node_t* node, glushkov_result_t* result)
+{
+    ++g->positions_len;
+    if (node->op == NONE)
+    {
+        g->labels[g->positions_len][(unsigned char) node->c / 64] |= (uint64_t) 1 << ((unsigned char) node->c % 64);
+    }
+    else
+    {
+        memcpy(g->labels[g->positions_len], node->set, sizeof(g->labels[0]));
+    }
+
+    if ((result->first.list = malloc(sizeof(int))) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+
+    if ((result->last.list = malloc(sizeof(int))) == NULL)
+    {
+        free(result->first.list);
+        return BAD_ALLOCATION;
+    }
+
+    result->first.list[0] = (int) g->positions_len;
+    result->last.list[0] = (int) g->positions_len;
+    result->first.len = 1;
+    result->last.len = 1;
+    result->nullable = false;
+    return OK;
+}
+
+// Replaces the results of the children of a star, concatenation or union with the one of the node
+static int glushkov_combine(glushkov_t* g, const node_t* node, glushkov_result_t* results, size_t* results_len)
+{
+    glushkov_result_t l, r, result;
+
+    if (node->op == STAR)
+    {
+        result = results[*results_len - 1];
+        ERROR_RETHROW(glushkov_follow(g, &result.last, &result.first));
+
+        results[*results_len - 1].nullable = true;
+        return OK;
+    }
+
+    // the children leave the stack, their lists are released here on failure
+    r = results[--*results_len];
+    l = results[--*results_len];
+
+    if (node->op == CONCAT)
+    {
+        ERROR_RETHROW(
+            glushkov_follow(g, &l.last, &r.first),
+            free(l.first.list); free(l.last.list); free(r.first.list); free(r.last.list)
+        );
+
+        result.nullable = l.nullable && r.nullable;
+        ERROR_RETHROW(
+            positions_join(&result.first, &l.first, &r.first, l.nullable),
+            free(l.last.list); free(r.last.list)
+        );
+        ERROR_RETHROW(
+            positions_join(&result.last, &r.last, &l.last, r.nullable),
+            free(result.first.list)
+        );
+    }
+    else
+    {
+        result.nullable = l.nullable || r.nullable;
+        ERROR_RETHROW(
+            positions_join(&result.first, &l.first, &r.first, true),
+            free(l.last.list); free(r.last.list)
+        );
+        ERROR_RETHROW(
+            positions_join(&result.last, &l.last, &r.last, true),
+            free(result.first.list)
+        );
+    }
+
+    results[(*results_len)++] = result;
+    return OK;
+}
+
+// Adds the edges from every position of from to every position of to
+static int glushkov_follow(glushkov_t* g, const positions_t* from, const positions_t* to)
+{
+    size_t needed = g->edges_len + from->len * to->len;
+    if (needed > g->edges_capacity)
+    {
+        size_t new_capacity = (g->edges_capacity == 0) ? 16 : g->edges_capacity;
+        while (new_capacity < needed)
+        {
+            new_capacity *= 2;
+        }
+
+        int* new_edges;
+        if ((new_edges = reallocarray(g->edges, new_capacity * 2, sizeof(int))) == NULL)
+        {
+            return BAD_ALLOCATION;
+        }
+
+        g->edges = new_edges;
+        g->edges_capacity = new_capacity;
+    }
+
+    size_t i, j;
+    for (i=0; i<from->len; ++i)
+    {
+        for (j=0; j<to->len; ++j)
+        {
+            g->edges[g->edges_len * 2] = from->list[i];
+            g->edges[g->edges_len * 2 + 1] = to->list[j];
+            ++g->edges_len;
+        }
+    }
+
+    return OK;
+}
+
+// Moves a, followed by b if with_b, into result; a and b are released
+static int positions_join(positions_t* result, positions_t* a, positions_t* b, bool with_b)
+{
+    if (!with_b || b->len == 0)
+    {
+        *result = *a;
+        free(b->list);
+        return OK;
+    }
+
+    int* list;
+    if ((list = reallocarray(a->list, a->len + b->len, sizeof(int))) == NULL)
+    {
+        free(a->list);
+        free(b->list);
+        return BAD_ALLOCATION;
+    }
+
+    memcpy(list + a->len, b->list, sizeof(int) * b->len);
+    result->list = list;
+    result->len = a->len + b->len;
+
+    free(b->list);
+    return OK;
+}
+
+static int nfa_simple(nfa_t* nfa, char c){
+    nfa_t temp;
+    ERROR_RETHROW(nfa_init(&temp, 2));
     
-    close(fd);
+    ERROR_RETHROW(
+        nfa_state_init(&temp.states[0], false),
+        nfa_destroy(&temp);
+    );
+    
+    ERROR_RETHROW(
+        nfa_state_init(&temp.states[1], true),
+        nfa_destroy(&temp);
+    );
+    
+    ERROR_RETHROW(
+        nfa_state_addsymbol(&temp.states[0], c, 1),
+        nfa_destroy(&temp);
+    );
+
+    *nfa = temp;
+    return 0;
+}
+
+// A single final state entered on every character of the set
+static int nfa_set(nfa_t* nfa, const uint64_t* set)
+{
+    nfa_t temp;
+    ERROR_RETHROW(nfa_init(&temp, 2));
+
+    ERROR_RETHROW(
+        nfa_state_init(&temp.states[0], false),
+        nfa_destroy(&temp)
+    );
+
+    ERROR_RETHROW(
+        nfa_state_init(&temp.states[1], true),
+        nfa_destroy(&temp)
+    );
+
+    size_t c;
+    for (c=1; c<ASCII_LEN; ++c)
+    {
+        if (set[c / 64] & ((uint64_t) 1 << (c % 64)))
+        {
+            ERROR_RETHROW(
+                nfa_state_addsymbol(&temp.states[0], (char) c, 1),
+                nfa_destroy(&temp)
+            );
+        }
+    }
+
+    *nfa = temp;
+    return OK;
+}
+
+static int nfa_concat(nfa_t* restrict nfa_left, nfa_t* restrict nfa_right){
+    nfa_t *nfa1 = nfa_left;
+    nfa_t *nfa2 = nfa_right;
+
+    // new nfa
+    nfa_t nfa;
+
+    ERROR_RETHROW(
+        nfa_init(&nfa, nfa1->states_len + nfa2->states_len - 1)
+    );
+
+    // MOVE nfa1 AS IS
+    size_t i;
+    for (i=0; i<nfa1->states_len; ++i){
+        nfa.states[i] = nfa1->states[i];
+    }
+
+    // MOVE nfa2 LESS INITIAL STATE AND CHANGING STATES' NUMBERS
+    size_t j;
+    i = nfa.states_len - 1;
+    for (j=nfa2->states_len - 1; j>0; --j){
+        nfa.states[i] = nfa2->states[j];
+        
+        size_t l;
+        for (l=0; l<nfa.states[i].len; ++l){
+            nfa.states[i].mapped_state[l] += nfa1->states_len - 1;
+        }
+        
+        --i;
+    }
+
+    // CONNECT FINAL STATES OF nfa1 TO nfa2
+    for (i=0; i<nfa1->states_len; ++i){
+        
+        if ( nfa.states[i].final ){
+            
+            for (j=0; j<nfa2->states[0].len; ++j)
+                ERROR_RETHROW(
+                        nfa_state_addsymbol(
+                                &nfa.states[i], nfa2->states[0].charset[j],
+                                nfa2->states[0].mapped_state[j] + nfa1->states_len - 1
+                                ),
+                        nfa_destroy(&nfa)
+                );
+            
+            nfa.states[i].final = nfa2->states[0].final; //state is final only if the initial state of nfa2 was
+        }
+    }
+
+    // CLEANING UP
+    nfa_state_deinit(&nfa2->states[0]);
+    nfa_deinit(nfa1);
+    nfa_deinit(nfa2);
+
+    *nfa_left = nfa;
+    return 0;
+}
+
+static int nfa_union(nfa_t* restrict nfa_left, nfa_t* restrict nfa_right){
+    nfa_t* nfa1 = nfa_left;
+    nfa_t* nfa2 = nfa_right;
+
+    nfa_t nfa;
+    ERROR_RETHROW(nfa_init(&nfa, nfa1->states_len + nfa2->states_len - 1));
+
+    // MOVE nfa1 AS IS
+    size_t i;
+    for (i=0; i<nfa1->states_len; ++i)
+    {
+        nfa.states[i] = nfa1->states[i];
+    }
+
+    // MOVE NFA2 LESS INITIAL STATE
+    size_t j;
+    i = nfa.states_len - 1;
+    for (j=nfa2->states_len - 1; j>0; --j)
+    {
+        nfa.states[i] = nfa2->states[j];
+        
+        // REDENOMINATE NFA2 STATES' NUMBERS
+        size_t l;
+        for (l=0; l<nfa.states[i].len; ++l)
+        {
+            nfa.states[i].mapped_state[l] += nfa1->states_len-1;
+        }
+
+        --i;
+    }
+
+    // INITIAL STATE OF NFA1 IS INITIAL STATE OF NFA2: COPY NFA2 INITIAL STATE TRANSITIONS INTO THE NEW INITIAL STATE
+    nfa.states[0].final = nfa.states[0].final || nfa2->states[0].final;
+    for (i=0; i<nfa2->states[0].len; ++i){
+        ERROR_RETHROW(
+            nfa_state_addsymbol(
+                &nfa.states[0], 
+                nfa2->states[0].charset[i], 
+                nfa2->states[0].mapped_state[i] + nfa1->states_len - 1
+            ),
+            nfa_destroy(&nfa)
+        );
+    }        
+
+    // CLEANING UP
+    nfa_state_deinit(&nfa2->states[0]);
+    nfa_deinit(nfa1);
+    nfa_deinit(nfa2);
+
+    *nfa_left = nfa;
+    
+    return 0;
+}
+
+static int nfa_star(nfa_t* nfa){
+    nfa_parallel_deinit(nfa);
+
+    //COPY THE INITIAL STATE TRANSITIONS INTO EVERY FINAL STATE
+    size_t i;
+    for (i=1; i<nfa->states_len; ++i){
+        if (nfa->states[i].final){
+            size_t j;
+            for (j=0; j<nfa->states[0].len; ++j)
+            {
+                ERROR_RETHROW(
+                    nfa_state_addsymbol(
+                        &nfa->states[i], 
+                        nfa->states[0].charset[j], 
+                        nfa->states[0].mapped_state[j]
+                    )
+                );
+            }
+        }
+    }
+    
+    nfa->states[0].final = true; //Accept null strings
+    return 0;
+}
+
+static void nfa_deinit(nfa_t* nfa)
+{
+    if (nfa != NULL)
+    {
+        if (nfa->states_len > 0 && nfa->states != NULL)
+        {
+            free(nfa->states);
+        }
+
+        nfa_parallel_deinit(nfa);
+
+        // the tags of a loaded NFA are in its mapping
+        if (nfa->mapping != NULL)
+        {
+            munmap(nfa->mapping, nfa->mapping_len);
+        }
+        else
+        {
+            free(nfa->tags);
+        }
+
+        nfa->tags = NULL;
+        nfa->mapping = NULL;
+        nfa->mapping_len = 0;
+
+        nfa->states_len = 0;
+        nfa->states = NULL;
+    }
+}
+
+static int nfa_state_init(state_t* state, bool final){
+    state->len = 0;
+    state->capacity = 0;
+    state->final = false;
+    
+    if ((state->charset = malloc(sizeof(char) * 5)) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+
+    if ((state->mapped_state = malloc(sizeof(int) * 5)) == NULL)
+    {
+        free(state->charset);
+        return BAD_ALLOCATION;
+    }
+    
+    state->capacity = 5;
+    state->final = final;
+    state->deterministic = false;
+    state->dead = false;
+    memset(state->symbols, 0, sizeof(state->symbols));
+    state->row = NULL;
+    return OK;
+}
+
+static int nfa_state_extend(state_t* state){
+    size_t new_capacity = state->capacity * 2;
+    char* new_charset;
+    int* new_mapped_state;
+
+    if ((new_charset = reallocarray(state->charset, new_capacity, sizeof(char))) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+
+    if ((new_mapped_state = reallocarray(state->mapped_state, new_capacity, sizeof(int))) == NULL)
+    {
+        free(new_charset);
+        return BAD_ALLOCATION;
+    }
+
+    state->capacity = new_capacity;
+    state->charset = new_charset;
+    state->mapped_state = new_mapped_state;
+    return 0;
+}
+
+static int nfa_state_addsymbol(state_t* state, char c, int ns){
+    #ifdef _DEBUG
+    assert(state->capacity > 0);
+    #endif
+
+    // the dense index no longer matches the transitions
+    if (state->row != NULL)
+    {
+        free(state->row);
+        state->row = NULL;
+    }
+
+    if (state->len >= state->capacity)
+    {
+        ERROR_RETHROW(nfa_state_extend(state));
+    }
+
+    state->charset[state->len] = c;
+    state->mapped_state[state->len] = ns;
+    ++state->len;
+
+    return 0;
+}
+
+static void nfa_state_deinit(state_t* state){
+    #ifdef _DEBUG
+    assert(state != NULL);
+    #endif
+
+    if (state->capacity > 0)
+    {
+        if (state->charset != NULL)
+        {
+            free(state->charset);
+        }
+
+        if (state->mapped_state != NULL)
+        {
+            free(state->mapped_state);
+        }
+
+        free(state->row);
+    }
+
+    state->charset = NULL;
+    state->mapped_state = NULL;
+    state->row = NULL;
+
+    state->capacity = 0;
+    state->len = 0;
+    state->final = false;
+}
+
+// Indexes the transitions of the state, leaving out those to states not in live (if given)
+static int nfa_state_compact(state_t* state, const bool* live)
+{
+    // a loaded state comes indexed
+    if (state->capacity == 0 && state->row != NULL)
+    {
+        return OK;
+    }
+
+    free(state->row);
+    state->row = NULL;
+    state->deterministic = false;
+    memset(state->symbols, 0, sizeof(state->symbols));
+
+    if (state->len == 0)
+    {
+        return OK;
+    }
+
+    // COUNT THE TRANSITIONS OF EVERY CHARACTER
+    int count[ASCII_LEN] = {0};
+    bool deterministic = true;
+    size_t edges = 0;
+
+    size_t j;
+    for (j=0; j<state->len; ++j)
+    {
+        size_t uc = (unsigned char) state->charset[j];
+        if (uc >= ASCII_LEN || (live != NULL && !live[state->mapped_state[j]]))
+        {
+            continue;
+        }
+
+        if (count[uc]++ > 0)
+        {
+            deterministic = false;
+        }
+
+        state->symbols[uc / 64] |= (uint64_t) 1 << (uc % 64);
+        ++edges;
+    }
+
+    if (deterministic)
+    {
+        if ((state->row = malloc(sizeof(int) * ASCII_LEN)) == NULL)
+        {
+            return BAD_ALLOCATION;
+        }
+
+        memset(state->row, -1, sizeof(int) * ASCII_LEN);
+        for (j=0; j<state->len; ++j)
+        {
+            size_t uc = (unsigned char) state->charset[j];
+            if (uc < ASCII_LEN && (live == NULL || live[state->mapped_state[j]]))
+            {
+                state->row[uc] = state->mapped_state[j];
+            }
+        }
+
+        state->deterministic = true;
+        return OK;
+    }
+
+    // OFFSETS OF EVERY CHARACTER IN THE BITMAP, THEN THE TARGETS
+    size_t m = nfa_state_rank(state, ASCII_LEN);
+    if ((state->row = malloc(sizeof(int) * (m + 1 + edges))) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+
+    int offset = 0;
+    size_t c, r = 0;
+    for (c=0; c<ASCII_LEN; ++c)
+    {
+        if (count[c] > 0)
+        {
+            state->row[r++] = offset;
+            offset += count[c];
+            count[c] = state->row[r-1]; // from here on, where the next target of c goes
+        }
+    }
+    state->row[m] = offset;
+
+    int* targets = state->row + m + 1;
+    for (j=0; j<state->len; ++j)
+    {
+        size_t uc = (unsigned char) state->charset[j];
+        if (uc < ASCII_LEN && (live == NULL || live[state->mapped_state[j]]))
+        {
+            targets[count[uc]++] = state->mapped_state[j];
+        }
+    }
+
     return OK;
 }
 
-/*** INTERNAL ***/
+// Drops the repeated (character, target) pairs of the state
+static void nfa_state_dedup(state_t* state)
+{
+    size_t j, k, len = 0;
+    for (j=0; j<state->len; ++j)
+    {
+        for (k=0; k<len; ++k)
+        {
+            if (state->charset[k] == state->charset[j] && state->mapped_state[k] == state->mapped_state[j])
+            {
+                break;
+            }
+        }
+
+        if (k == len)
+        {
+            state->charset[len] = state->charset[j];
+            state->mapped_state[len] = state->mapped_state[j];
+            ++len;
+        }
+    }
+
+    if (len < state->len)
+    {
+        state->len = len;
+
+        // the dense index no longer matches the transitions
+        free(state->row);
+        state->row = NULL;
+        state->deterministic = false;
+        memset(state->symbols, 0, sizeof(state->symbols));
+    }
+}
 
+/*
+    Coarsest bisimulation of the states into block, numbered from 0 in the order
+    of their first state. Going forward, equivalent states have the same tag and
+    reach the same blocks on every character; going backward, they are entered
+    from the same blocks on every character and only the initial state is initial.
+    A partition is refined by the signature of every state, its block followed by
+    its sorted (character, block) pairs, until the number of blocks stays the same.
+*/
+static int nfa_bisimulation(const nfa_t* nfa, bool backward, int* block, size_t* blocks_len)
+{
+    size_t n = nfa->states_len;
 
-static int nfa_delta(nfa_t* nfa, char c){
-    int* next_states;
-    if ((next_states = malloc(sizeof(int) * nfa->current_states_len)) == NULL)
+    // TRANSITIONS GROUPED BY OWNER: THE SOURCE GOING FORWARD, THE TARGET GOING BACKWARD
+    size_t* first;
+    if ((first = calloc(n + 1, sizeof(size_t))) == NULL)
+    {
         return BAD_ALLOCATION;
+    }
 
-    size_t next_states_len = 0;
-    size_t next_states_capacity = nfa->current_states_len;
+    size_t s, j, edges_len = 0;
+    for (s=0; s<n; ++s)
+    {
+        for (j=0; j<nfa->states[s].len; ++j)
+        {
+            size_t owner = backward ? (size_t) nfa->states[s].mapped_state[j] : s;
+            ++first[owner + 1];
+            ++edges_len;
+        }
+    }
 
-    size_t i;
-    for (i=0; i<nfa->current_states_len; ++i){
-        int k = nfa->current_states[i];
+    for (s=0; s<n; ++s)
+    {
+        first[s + 1] += first[s];
+    }
+
+    // an edge is its character and the other end, a signature entry its character and the block of that end
+    uint64_t* edges = malloc(sizeof(uint64_t) * (edges_len + 1));
+    uint64_t* signatures = malloc(sizeof(uint64_t) * (edges_len + n));
+    size_t* signatures_len = malloc(sizeof(size_t) * n);
+    size_t* fill = malloc(sizeof(size_t) * n);
+    int* next_block = malloc(sizeof(int) * n);
+
+    size_t buckets_len = 1;
+    while (buckets_len < n * 2)
+    {
+        buckets_len *= 2;
+    }
+    int* buckets = malloc(sizeof(int) * buckets_len);
+
+    if (edges == NULL || signatures == NULL || signatures_len == NULL || fill == NULL || next_block == NULL || buckets == NULL)
+    {
+        free(first);
+        free(edges);
+        free(signatures);
+        free(signatures_len);
+        free(fill);
+        free(next_block);
+        free(buckets);
+        return BAD_ALLOCATION;
+    }
+
+    memcpy(fill, first, sizeof(size_t) * n);
+    for (s=0; s<n; ++s)
+    {
+        for (j=0; j<nfa->states[s].len; ++j)
+        {
+            size_t t = (size_t) nfa->states[s].mapped_state[j];
+            size_t owner = backward ? t : s;
+            uint64_t c = (unsigned char) nfa->states[s].charset[j];
+
+            edges[fill[owner]++] = (c << 32) | (backward ? s : t);
+        }
+    }
+
+    // INITIAL PARTITION: BY TAG GOING FORWARD, THE INITIAL STATE APART GOING BACKWARD
+    for (s=0; s<n; ++s)
+    {
+        uint64_t key;
+        if (backward)
+        {
+            key = (s == 0) ? 0 : 1;
+        }
+        else
+        {
+            key = nfa->states[s].final ? 1 + (uint64_t) (nfa->tags != NULL ? nfa->tags[s] + 1 : 0) : 0;
+        }
+
+        signatures[first[s] + s] = key;
+        signatures_len[s] = 1;
+    }
+
+    size_t len = bisimulation_group(signatures, first, signatures_len, n, buckets, buckets_len, block);
+
+    while (true)
+    {
+        for (s=0; s<n; ++s)
+        {
+            uint64_t* signature = &signatures[first[s] + s];
+            size_t k, m = first[s + 1] - first[s];
+
+            signature[0] = (uint64_t) block[s];
+            for (k=0; k<m; ++k)
+            {
+                uint64_t edge = edges[first[s] + k];
+                signature[k + 1] = (edge & ~(uint64_t) UINT32_MAX) | (uint64_t) block[edge & UINT32_MAX];
+            }
 
-        size_t j;        
-        for (j=0; j<nfa->states[k].len; ++j){
+            // sorted and without repetitions, equal sets of pairs compare equal
+            qsort(signature + 1, m, sizeof(uint64_t), signature_compare);
 
-            if (nfa->states[k].charset[j] == c)
+            size_t unique = (m > 0) ? 2 : 1;
+            for (k=2; k<=m; ++k)
             {
-                
-                if (next_states_len >= next_states_capacity)
+                if (signature[k] != signature[unique - 1])
                 {
-                    if ((next_states = reallocarray(next_states, next_states_capacity * 2, sizeof(int))) == NULL)
-                    {
-                        free(next_states);
-                        return BAD_ALLOCATION;
-                    }
-                    next_states_capacity *= 2;
+                    signature[unique++] = signature[k];
                 }
+            }
+
+            signatures_len[s] = unique;
+        }
+
+        size_t next_len = bisimulation_group(signatures, first, signatures_len, n, buckets, buckets_len, next_block);
+        memcpy(block, next_block, sizeof(int) * n);
+
+        if (next_len == len)
+        {
+            break;
+        }
+
+        len = next_len;
+    }
+
+    free(first);
+    free(edges);
+    free(signatures);
+    free(signatures_len);
+    free(fill);
+    free(next_block);
+    free(buckets);
+
+    *blocks_len = len;
+    return OK;
+}
+
+// Numbers the distinct signatures into block in order of first appearance, returns their number
+static size_t bisimulation_group(const uint64_t* signatures, const size_t* first, const size_t* signatures_len, size_t n, int* buckets, size_t buckets_len, int* block)
+{
+    memset(buckets, -1, sizeof(int) * buckets_len);
+
+    size_t s, len = 0;
+    for (s=0; s<n; ++s)
+    {
+        const uint64_t* signature = &signatures[first[s] + s];
+
+        // FNV-1a over the entries
+        uint64_t hash = 0xcbf29ce484222325u;
+        size_t k;
+        for (k=0; k<signatures_len[s]; ++k)
+        {
+            hash = (hash ^ signature[k]) * 0x100000001b3u;
+        }
+
+        size_t h = (size_t) hash & (buckets_len - 1);
+        while (true)
+        {
+            int r = buckets[h];
+            if (r == -1)
+            {
+                buckets[h] = (int) s;
+                block[s] = (int) len++;
+                break;
+            }
 
-                next_states[next_states_len++] = nfa->states[k].mapped_state[j];
+            if (signatures_len[r] == signatures_len[s]
+                && memcmp(&signatures[first[r] + (size_t) r], signature, sizeof(uint64_t) * signatures_len[s]) == 0)
+            {
+                block[s] = block[r];
+                break;
             }
+
+            h = (h + 1) & (buckets_len - 1);
         }
     }
 
-    free(nfa->current_states);
-    nfa->current_states = next_states;
-    nfa->current_states_len = next_states_len;
-    nfa->current_states_capacity = next_states_capacity;
+    return len;
+}
+
+static int signature_compare(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
 
-    return 0;
+static int layout_compare(const void* a, const void* b)
+{
+    const layout_key_t* x = a;
+    const layout_key_t* y = b;
+
+    if (x->visits != y->visits)
+    {
+        return (x->visits < y->visits) - (x->visits > y->visits);
+    }
 
+    return (x->rank > y->rank) - (x->rank < y->rank);
 }
 
-static int nfa_init(nfa_t* nfa, size_t n_states){
-    nfa_t tmp_nfa;
-    
-    if ((tmp_nfa.states = calloc((size_t) n_states, sizeof(state_t))) == NULL)
+// Counts a visit of every active state of the match
+static void match_visit(const match_t* match, size_t* visits)
+{
+    if (match_is_dead(match))
     {
-        return BAD_ALLOCATION;
+        return;
     }
 
-    tmp_nfa.states_len = n_states;
+    if (match->nfa->parallel != NULL)
+    {
+        size_t w;
+        for (w=0; w<match->nfa->parallel->words; ++w)
+        {
+            uint64_t bits = match->parallel_states[w];
+            while (bits != 0)
+            {
+                ++visits[w * 64 + (size_t) __builtin_ctzll(bits)];
+                bits &= bits - 1;
+            }
+        }
 
-    *nfa = tmp_nfa;
-    return 0;
+        return;
+    }
+
+    size_t i;
+    for (i=0; i<match->states_len; ++i)
+    {
+        ++visits[match->states[i]];
+    }
 }
 
-static int nfa_simple(nfa_t* nfa, char c){
+// Replaces the NFA with its quotient by the partition of its states into blocks_len blocks
+static int nfa_quotient(nfa_t* nfa, const int* block, size_t blocks_len)
+{
     nfa_t temp;
-    ERROR_RETHROW(nfa_init(&temp, 3));
-    
-    ERROR_RETHROW(
-        nfa_state_init(&temp.states[0], false),
-        nfa_destroy(&temp);
-    );
-    
-    ERROR_RETHROW(
-        nfa_state_init(&temp.states[1], true),
-        nfa_destroy(&temp);
-    );
-    
-    ERROR_RETHROW(
-        nfa_state_addsymbol(&temp.states[0], c, 1),
-        nfa_destroy(&temp);
-    );
+    ERROR_RETHROW(nfa_init(&temp, blocks_len));
+
+    size_t b, s, j;
+    for (b=0; b<blocks_len; ++b)
+    {
+        ERROR_RETHROW(nfa_state_init(&temp.states[b], false), nfa_destroy(&temp));
+    }
+
+    if (nfa->tags != NULL)
+    {
+        if ((temp.tags = malloc(sizeof(int) * blocks_len)) == NULL)
+        {
+            nfa_destroy(&temp);
+            return BAD_ALLOCATION;
+        }
+
+        for (b=0; b<blocks_len; ++b)
+        {
+            temp.tags[b] = NFA_NO_TAG;
+        }
+    }
+
+    for (s=0; s<nfa->states_len; ++s)
+    {
+        state_t* state = &temp.states[block[s]];
+
+        if (nfa->states[s].final)
+        {
+            state->final = true;
+
+            // the lowest tag has the priority
+            if (temp.tags != NULL && (temp.tags[block[s]] == NFA_NO_TAG || nfa->tags[s] < temp.tags[block[s]]))
+            {
+                temp.tags[block[s]] = nfa->tags[s];
+            }
+        }
+
+        for (j=0; j<nfa->states[s].len; ++j)
+        {
+            ERROR_RETHROW(
+                nfa_state_addsymbol(state, nfa->states[s].charset[j], block[nfa->states[s].mapped_state[j]]),
+                nfa_destroy(&temp)
+            );
+        }
+    }
+
+    for (b=0; b<blocks_len; ++b)
+    {
+        nfa_state_dedup(&temp.states[b]);
+    }
 
+    nfa_destroy(nfa);
     *nfa = temp;
-    return 0;
+    return OK;
 }
 
-static int nfa_concat(nfa_t* restrict nfa_left, nfa_t* restrict nfa_right){
-    nfa_t *nfa1 = nfa_left;
-    nfa_t *nfa2 = nfa_right;
+// Marks in live the states from which a final state can be reached
+static int nfa_live_states(const nfa_t* nfa, bool* live)
+{
+    size_t n = nfa->states_len;
+
+    // PREDECESSORS OF EVERY STATE, GROUPED BY A COUNTING SORT
+    size_t* first;
+    if ((first = calloc(n + 1, sizeof(size_t))) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+
+    size_t s, j, edges = 0;
+    for (s=0; s<n; ++s)
+    {
+        for (j=0; j<nfa->states[s].len; ++j)
+        {
+            ++first[nfa->states[s].mapped_state[j] + 1];
+            ++edges;
+        }
+    }
+
+    for (s=0; s<n; ++s)
+    {
+        first[s + 1] += first[s];
+    }
+
+    int* sources;
+    int* stack;
+
+    if ((sources = malloc(sizeof(int) * (edges + 1))) == NULL)
+    {
+        free(first);
+        return BAD_ALLOCATION;
+    }
 
-    // new nfa
-    nfa_t nfa;
+    if ((stack = malloc(sizeof(int) * n)) == NULL)
+    {
+        free(first);
+        free(sources);
+        return BAD_ALLOCATION;
+    }
 
-    ERROR_RETHROW(
-        nfa_init(&nfa, nfa1->states_len + nfa2->states_len - 1)
-    );
+    for (s=0; s<n; ++s)
+    {
+        for (j=0; j<nfa->states[s].len; ++j)
+        {
+            sources[first[nfa->states[s].mapped_state[j]]++] = (int) s;
+        }
+    }
 
-    // MOVE nfa1 AS IS
-    size_t i;
-    for (i=0; i<nfa1->states_len; ++i){
-        nfa.states[i] = nfa1->states[i];
+    // first[t] moved to the end of the predecessors of t: shift it back
+    for (s=n; s>0; --s)
+    {
+        first[s] = first[s - 1];
     }
+    first[0] = 0;
 
-    // MOVE nfa2 LESS INITIAL STATE AND CHANGING STATES' NUMBERS
-    size_t j;
-    i = nfa.states_len - 1;
-    for (j=nfa2->states_len - 1; j>0; --j){
-        nfa.states[i] = nfa2->states[j];
-        
-        size_t l;
-        for (l=0; l<nfa.states[i].len; ++l){
-            nfa.states[i].mapped_state[l] += nfa1->states_len - 1;
+    // BACKWARDS FROM THE FINAL STATES
+    size_t stack_len = 0;
+    for (s=0; s<n; ++s)
+    {
+        live[s] = nfa->states[s].final;
+        if (live[s])
+        {
+            stack[stack_len++] = (int) s;
         }
-        
-        --i;
     }
 
-    // CONNECT FINAL STATES OF nfa1 TO nfa2
-    for (i=0; i<nfa1->states_len; ++i){
-        
-        if ( nfa.states[i].final ){
-            
-            for (j=0; j<nfa2->states[0].len; ++j)
-                ERROR_RETHROW(
-                        nfa_state_addsymbol(
-                                &nfa.states[i], nfa2->states[0].charset[j],
-                                nfa2->states[0].mapped_state[j] + nfa1->states_len - 1
-                                ),
-                        nfa_destroy(&nfa)
-                );
-            
-            nfa.states[i].final = nfa2->states[0].final; //state is final only if the initial state of nfa2 was
+    while (stack_len > 0)
+    {
+        int t = stack[--stack_len];
+
+        size_t k;
+        for (k=first[t]; k<first[t + 1]; ++k)
+        {
+            if (!live[sources[k]])
+            {
+                live[sources[k]] = true;
+                stack[stack_len++] = sources[k];
+            }
         }
     }
 
-    // CLEANING UP
-    nfa_state_deinit(&nfa2->states[0]);
-    nfa_deinit(nfa1);
-    nfa_deinit(nfa2);
-
-    *nfa_left = nfa;
-    return 0;
+    free(first);
+    free(sources);
+    free(stack);
+    return OK;
 }
 
-static int nfa_union(nfa_t* restrict nfa_left, nfa_t* restrict nfa_right){
-    nfa_t* nfa1 = nfa_left;
-    nfa_t* nfa2 = nfa_right;
+// Total number of transitions of the NFA
+static size_t nfa_transitions_len(const nfa_t* nfa)
+{
+    size_t i, len = 0;
+    for (i=0; i<nfa->states_len; ++i)
+    {
+        len += nfa->states[i].len;
+    }
 
-    nfa_t nfa;
-    ERROR_RETHROW(nfa_init(&nfa, nfa1->states_len + nfa2->states_len - 1));
+    return len;
+}
 
-    // MOVE nfa1 AS IS
-    size_t i;
-    for (i=0; i<nfa1->states_len; ++i)
+// Number of characters below c having a transition
+static size_t nfa_state_rank(const state_t* state, size_t c)
+{
+    size_t rank = 0;
+    size_t w;
+    for (w=0; w<c / 64; ++w)
     {
-        nfa.states[i] = nfa1->states[i];
+        rank += (size_t) __builtin_popcountll(state->symbols[w]);
     }
 
-    // MOVE NFA2 LESS INITIAL STATE
-    size_t j;
-    i = nfa.states_len - 1;
-    for (j=nfa2->states_len - 1; j>0; --j)
+    if (c % 64 != 0)
     {
-        nfa.states[i] = nfa2->states[j];
-        
-        // REDENOMINATE NFA2 STATES' NUMBERS
-        size_t l;
-        for (l=0; l<nfa.states[i].len; ++l)
-        {
-            nfa.states[i].mapped_state[l] += nfa1->states_len-1;
-        }
-
-        --i;
+        rank += (size_t) __builtin_popcountll(state->symbols[w] & (((uint64_t) 1 << (c % 64)) - 1));
     }
 
-    // INITIAL STATE OF NFA1 IS INITIAL STATE OF NFA2: COPY NFA2 INITIAL STATE TRANSITIONS INTO THE NEW INITIAL STATE
-    for (i=0; i<nfa2->states[0].len; ++i){
-        ERROR_RETHROW(
-            nfa_state_addsymbol(
-                &nfa.states[0], 
-                nfa2->states[0].charset[i], 
-                nfa2->states[0].mapped_state[i] + nfa1->states_len - 1
-            ),
-            nfa_destroy(&nfa)
-        );
-    }        
+    return rank;
+}
 
-    // CLEANING UP
-    nfa_state_deinit(&nfa2->states[0]);
-    nfa_deinit(nfa1);
-    nfa_deinit(nfa2);
+// Splits every class partially covered by set into its part inside and its part outside set
+static void classes_refine(unsigned char* class_map, size_t* classes_len, const uint64_t* set)
+{
+    bool outside[ASCII_LEN] = {false};
+    int split[ASCII_LEN];
+    memset(split, -1, sizeof(split));
 
-    *nfa_left = nfa;
-    
-    return 0;
-}
+    size_t c;
+    for (c=0; c<ASCII_LEN; ++c)
+    {
+        if (!(set[c / 64] & ((uint64_t) 1 << (c % 64))))
+        {
+            outside[class_map[c]] = true;
+        }
+    }
 
-static int nfa_star(nfa_t* nfa){
-    //COPY THE INITIAL STATE TRANSITIONS INTO EVERY FINAL STATE
-    size_t i;
-    for (i=1; i<nfa->states_len; ++i){
-        if (nfa->states[i].final){
-            size_t j;
-            for (j=0; j<nfa->states[0].len; ++j)
+    for (c=0; c<ASCII_LEN; ++c)
+    {
+        size_t k = class_map[c];
+        if ((set[c / 64] & ((uint64_t) 1 << (c % 64))) && outside[k])
+        {
+            if (split[k] == -1)
             {
-                ERROR_RETHROW(
-                    nfa_state_addsymbol(
-                        &nfa->states[i], 
-                        nfa->states[0].charset[j], 
-                        nfa->states[0].mapped_state[j]
-                    )
-                );
+                split[k] = (int) (*classes_len)++;
             }
+
+            class_map[c] = (unsigned char) split[k];
         }
     }
-    
-    nfa->states[0].final = true; //Accept null strings
-    return 0;
 }
 
-static void nfa_deinit(nfa_t* nfa)
+static int nfa_parallel_init(nfa_t* nfa)
 {
-    if (nfa != NULL)
+    nfa_parallel_deinit(nfa);
+
+    size_t n = nfa->states_len;
+    if (n > NFA_PARALLEL_MAX_STATES)
     {
-        if (nfa->states_len > 0 && nfa->states != NULL)
+        return OK;
+    }
+
+    // CHECK THAT EVERY STATE IS ENTERED ON THE SAME CHARACTERS FROM EVERY PREDECESSOR
+    uint64_t label[NFA_PARALLEL_MAX_STATES][SYMBOLS_WORDS];
+    uint64_t entering[NFA_PARALLEL_MAX_STATES][SYMBOLS_WORDS];
+    bool labelled[NFA_PARALLEL_MAX_STATES];
+    size_t touched[NFA_PARALLEL_MAX_STATES];
+
+    memset(entering, 0, sizeof(entering[0]) * n);
+    memset(labelled, 0, sizeof(bool) * n);
+
+    size_t s, j;
+    for (s=0; s<n; ++s)
+    {
+        // the characters from s to each of its successors
+        size_t touched_len = 0;
+        for (j=0; j<nfa->states[s].len; ++j)
         {
-            free(nfa->states);
+            size_t c = (unsigned char) nfa->states[s].charset[j];
+            size_t t = (size_t) nfa->states[s].mapped_state[j];
+
+            if (c >= ASCII_LEN)
+            {
+                return OK;
+            }
+
+            if (entering[t][0] == 0 && entering[t][1] == 0)
+            {
+                touched[touched_len++] = t;
+            }
+
+            entering[t][c / 64] |= (uint64_t) 1 << (c % 64);
         }
 
-        nfa->states_len = 0;
-        nfa->states = NULL;
+        size_t k;
+        for (k=0; k<touched_len; ++k)
+        {
+            size_t t = touched[k];
+            if (!labelled[t])
+            {
+                memcpy(label[t], entering[t], sizeof(label[t]));
+                labelled[t] = true;
+            }
+            else if (memcmp(label[t], entering[t], sizeof(label[t])) != 0)
+            {
+                return OK;
+            }
+
+            memset(entering[t], 0, sizeof(entering[t]));
+        }
     }
-}
 
-static int nfa_state_init(state_t* state, bool final){
-    state->len = 0;
-    state->capacity = 0;
-    state->final = false;
-    
-    if ((state->charset = malloc(sizeof(char) * 5)) == NULL)
+    size_t words = (n + 63) / 64;
+    size_t chunks = words * 16;
+
+    nfa_parallel_t* parallel;
+    if ((parallel = malloc(sizeof(nfa_parallel_t))) == NULL)
     {
         return BAD_ALLOCATION;
     }
 
-    if ((state->mapped_state = malloc(sizeof(int) * 5)) == NULL)
+    // entered, final and follow in a single block
+    if ((parallel->entered = calloc((ASCII_LEN + 1 + chunks * 16) * words, sizeof(uint64_t))) == NULL)
     {
-        free(state->charset);
+        free(parallel);
         return BAD_ALLOCATION;
     }
-    
-    state->capacity = 5;
-    state->final = final;
-    return OK;
-}
 
-static int nfa_state_extend(state_t* state){
-    size_t new_capacity = state->capacity * 2;
-    char* new_charset;
-    int* new_mapped_state;
+    parallel->words = words;
+    parallel->final = parallel->entered + ASCII_LEN * words;
+    parallel->follow = parallel->final + words;
 
-    if ((new_charset = reallocarray(state->charset, new_capacity, sizeof(char))) == NULL)
+    for (s=0; s<n; ++s)
     {
-        return BAD_ALLOCATION;
+        uint64_t bit = (uint64_t) 1 << (s % 64);
+
+        size_t c;
+        for (c=0; labelled[s] && c<ASCII_LEN; ++c)
+        {
+            if (label[s][c / 64] & ((uint64_t) 1 << (c % 64)))
+            {
+                parallel->entered[c * words + s / 64] |= bit;
+            }
+        }
+
+        if (nfa->states[s].final)
+        {
+            parallel->final[s / 64] |= bit;
+        }
     }
 
-    if ((new_mapped_state = reallocarray(state->mapped_state, new_capacity, sizeof(int))) == NULL)
+    // FOLLOW TABLE: the successors of a subset are those of its lowest state plus those of the rest
+    size_t k, v, w;
+    for (k=0; k<chunks; ++k)
     {
-        free(new_charset);
-        return BAD_ALLOCATION;
+        for (v=1; v<16; ++v)
+        {
+            uint64_t* entry = &parallel->follow[(k * 16 + v) * words];
+            const uint64_t* rest = &parallel->follow[(k * 16 + (v & (v - 1))) * words];
+            size_t lowest = k * 4 + (size_t) __builtin_ctz((unsigned int) v);
+
+            for (w=0; w<words; ++w)
+            {
+                entry[w] = rest[w];
+            }
+
+            if (lowest < n)
+            {
+                for (j=0; j<nfa->states[lowest].len; ++j)
+                {
+                    size_t t = (size_t) nfa->states[lowest].mapped_state[j];
+                    if (!nfa->states[t].dead)
+                    {
+                        entry[t / 64] |= (uint64_t) 1 << (t % 64);
+                    }
+                }
+            }
+        }
     }
 
-    state->capacity = new_capacity;
-    state->charset = new_charset;
-    state->mapped_state = new_mapped_state;
-    return 0;
+    nfa->parallel = parallel;
+    return OK;
 }
 
-static int nfa_state_addsymbol(state_t* state, char c, int ns){
-    if (state->len >= state->capacity)
+static void nfa_parallel_deinit(nfa_t* nfa)
+{
+    if (nfa->parallel != NULL)
     {
-        ERROR_RETHROW(nfa_state_extend(state));
+        free(nfa->parallel->entered);
+        free(nfa->parallel);
+        nfa->parallel = NULL;
     }
-
-    state->charset[state->len] = c;
-    state->mapped_state[state->len] = ns;
-    ++state->len;
-
-    return 0;
 }
 
-static void nfa_state_deinit(state_t* state){
-    #ifdef _DEBUG
-    assert(state != NULL);
-    #endif
+static bool nfa_parallel_accepts(const nfa_parallel_t* parallel, const char* string)
+{
+    uint64_t states[NFA_PARALLEL_MAX_WORDS] = {1};
 
-    if (state->capacity > 0)
+    size_t i;
+    for (i=0; string[i] != '\0'; ++i)
     {
-        if (state->charset != NULL)
+        if (!nfa_parallel_step(parallel, states, string[i]))
         {
-            free(state->charset);
+            return false;
         }
+    }
 
-        if (state->mapped_state != NULL)
+    return nfa_parallel_final(parallel, states);
+}
+
+// Advances the state set by one character, returns whether any state is left
+static bool nfa_parallel_step(const nfa_parallel_t* parallel, uint64_t* states, char c)
+{
+    size_t words = parallel->words;
+    size_t uc = (unsigned char) c;
+    uint64_t next[NFA_PARALLEL_MAX_WORDS] = {0};
+
+    if (uc >= ASCII_LEN)
+    {
+        memset(states, 0, sizeof(uint64_t) * words);
+        return false;
+    }
+
+    // FOLLOW THE ACTIVE STATES 4 AT A TIME
+    size_t w, k;
+    for (w=0; w<words; ++w)
+    {
+        uint64_t bits = states[w];
+        for (k=0; bits != 0; ++k, bits >>= 4)
         {
-            free(state->mapped_state);
+            size_t v = bits & 15;
+            if (v != 0)
+            {
+                const uint64_t* entry = &parallel->follow[((w * 16 + k) * 16 + v) * words];
+
+                size_t l;
+                for (l=0; l<words; ++l)
+                {
+                    next[l] |= entry[l];
+                }
+            }
         }
     }
 
-    state->charset = NULL;
-    state->mapped_state = NULL;
+    // KEEP THE STATES ENTERED ON c
+    uint64_t alive = 0;
+    for (w=0; w<words; ++w)
+    {
+        states[w] = next[w] & parallel->entered[uc * words + w];
+        alive |= states[w];
+    }
 
-    state->capacity = 0;
-    state->len = 0;
-    state->final = false;
+    return alive != 0;
 }
 
+static bool nfa_parallel_final(const nfa_parallel_t* parallel, const uint64_t* states)
+{
+    size_t w;
+    for (w=0; w<parallel->words; ++w)
+    {
+        if (states[w] & parallel->final[w])
+        {
+            return true;
+        }
+    }
 
+    return false;
+}
@@ -2,9 +2,6 @@
 #include <compiler_errors.h>
 #include <assert.h>
 
-#define node_deallocate(__PTR) \
-	(free(__PTR))
-
 #define peek(_REGEXPR, _INDEX) \
 	(_REGEXPR[_INDEX])
 
@@ -12,10 +9,22 @@
 	(_REGEXPR[(*(_INDEX))++])
 
 
+// Frame of tree_optimize: the slot of a node, and whether its children are already optimized
+typedef struct _optimize_frame{
+	node_t** slot;
+	bool expanded;
+} optimize_frame_t;
+
+
 /* HELPERS */
-static int parser_recursive(node_t**, const char*, int*, bool);
+static int parser_iterative(tree_arena_t*, node_t**, const char*, node_t**);
 static char graph_rec(node_t* node, FILE* f);
-static int node_allocate(node_t**, op_t);
+static int node_allocate(tree_arena_t*, node_t**, op_t);
+static int class_parse(uint64_t*, const char*, int*);
+static void class_add(uint64_t*, unsigned char, unsigned char);
+static bool node_is_leaf(const node_t*);
+static void node_merge(node_t*, const node_t*);
+static void node_fold(node_t**);
 /* ******* */
 
 void tree_deinit(node_t** node)
@@ -25,15 +34,7 @@ void tree_deinit(node_t** node)
 	assert(*node != NULL);
 	#endif
 
-	if ((*node)->l_child != NULL){
-		tree_deinit(&(*node)->l_child);
-	}
-
-	if ((*node)->r_child != NULL){
-		tree_deinit(&(*node)->r_child);
-	}
-	
-	free(*node);
+	free((*node)->arena);
 	*node = NULL;
 
 	return;
@@ -42,164 +43,232 @@ void tree_deinit(node_t** node)
 
 int tree_parse(node_t** node, const char* str)
 {
-	int i=0;
 	assert(str != NULL);
-	return parser_recursive(node, str, &i, false);
-}
 
-static int parser_recursive(node_t** node, const char* regexpr, int* regexpr_index, bool escape){
+	// every character adds at most 2 nodes, plus the root
+	size_t len = strlen(str);
+	size_t capacity = 2 * len + 1;
 
-	char c, k;
-	if (peek(regexpr, *regexpr_index) == '\0')
-	{	
-		*node = NULL;
-		return OK;
+	tree_arena_t* arena;
+	if ((arena = malloc(sizeof(tree_arena_t) + sizeof(node_t) * capacity)) == NULL)
+	{
+		return BAD_ALLOCATION;
 	}
-	
-	c = eat(regexpr, regexpr_index);
-	k = peek(regexpr, *regexpr_index);
 
-	if (!escape){
-		switch (c){
-			case ')':
-				*node = NULL;
-				return OK;
+	arena->len = 0;
+	arena->capacity = capacity;
 
-			case '+':
-			case '*':
-				*node = NULL;
-				return ILLFORMED_REGEXPR;
+	// at most one open group per character
+	node_t** groups;
+	if ((groups = malloc(sizeof(node_t*) * (len + 1))) == NULL)
+	{
+		free(arena);
+		return BAD_ALLOCATION;
+	}
 
-			case '\\':
-				return parser_recursive(node, regexpr, regexpr_index, true);
-	
-			case '(':
-				if (k == '+' || k == '*' || k == '\0')
-				{
-					*node = NULL;
-					return ILLFORMED_REGEXPR;
-				}
+	*node = NULL;
+	ERROR_RETHROW(
+		parser_iterative(arena, node, str, groups),
+		free(groups); free(arena); *node = NULL
+	);
 
-				// allocate a new concatenating node
-				ERROR_RETHROW(node_allocate(node, CONCAT));
+	free(groups);
 
-				// descend onto the left node
-				ERROR_RETHROW(
-					parser_recursive(&(*node)->l_child, regexpr, regexpr_index, false),
-					tree_deinit(node);
-				);
+	if (*node == NULL)
+	{
+		free(arena);
+	}
 
-				// peek if there is a '+' or a '*' behind
-				k = peek(regexpr, *regexpr_index);
-				if (k == '*')
-				{
-					
-					// allocate new kleene node between parent and left child
-					node_t* intermediate;
-					ERROR_RETHROW(
-						node_allocate(&intermediate, STAR),
-						tree_deinit(node)
-					);
-
-					intermediate->l_child = (*node)->l_child;
-					(*node)->l_child = intermediate;
-
-					// eat out eventual additional stars
-					do
-					{
-						(void) eat(regexpr, regexpr_index);
-					}
-					while(peek(regexpr, *regexpr_index) == '*');
-
-				} // Otherwise check if there is a '+' ahead
-				else if (k == '+')
-				{
+	return OK;
+}
 
-					//this becomes a union node
-					(*node)->op = UNION;
-					(void) eat(regexpr, regexpr_index);
-				}
+int tree_optimize(node_t** node)
+{
+	#ifdef _DEBUG
+	assert(node != NULL);
+	assert(*node != NULL);
+	#endif
+
+	// every node is on the stack at most once, either before or after its children
+	optimize_frame_t* frames;
+	if ((frames = malloc(sizeof(optimize_frame_t) * ((*node)->arena->len + 1))) == NULL)
+	{
+		return BAD_ALLOCATION;
+	}
 
-				// descend into right node
-				ERROR_RETHROW(
-					parser_recursive(&(*node)->r_child, regexpr, regexpr_index, false),
-					tree_deinit(node);
-				);
+	size_t frames_len = 0;
+	frames[frames_len++] = (optimize_frame_t){node, false};
+
+	while (frames_len > 0)
+	{
+		optimize_frame_t frame = frames[--frames_len];
+		node_t* n = *frame.slot;
+		node_t* temp;
+
+		if (frame.expanded)
+		{
+			node_fold(frame.slot);
+			continue;
+		}
 
-				// Backtrack if last node is null
-				if ((*node)->r_child == NULL)
+		switch (n->op){
+			case STAR:
+				frames[frames_len++] = (optimize_frame_t){frame.slot, true};
+				frames[frames_len++] = (optimize_frame_t){&n->l_child, false};
+				break;
+
+			case CONCAT:
+			case UNION:
+				// FLATTEN: (a.b).c becomes a.(b.c), so that chains only nest on the right
+				while (n->l_child->op == n->op)
 				{
-					node_t* temp = (*node)->l_child;
-					**node = *temp;
+					temp = n->l_child;
+					n->l_child = temp->r_child;
+					temp->r_child = n;
+					n = temp;
+				}
+				*frame.slot = n;
 
-					node_deallocate(temp);
+				if (n->op == UNION)
+				{
+					frames[frames_len++] = (optimize_frame_t){frame.slot, true};
 				}
-				
-				return OK;
-			
+				frames[frames_len++] = (optimize_frame_t){&n->r_child, false};
+				frames[frames_len++] = (optimize_frame_t){&n->l_child, false};
+				break;
+
 			default:
 				break;
 		}
 	}
 
-	// allocate a new concatenating node
-	ERROR_RETHROW(node_allocate(node, CONCAT));
+	free(frames);
+	return OK;
+}
 
-	// allocate new left child
-	ERROR_RETHROW(
-		node_allocate(&(*node)->l_child, NONE),
-		tree_deinit(node)
-	);
+// Parses the whole expression, sequence after sequence, with an explicit stack of the open groups
+static int parser_iterative(tree_arena_t* arena, node_t** root, const char* regexpr, node_t** groups)
+{
+	int index = 0;
+	int* regexpr_index = &index;
+	size_t groups_len = 0;
 
-	// set the left child to the character literal
-	(*node)->l_child->c = c;
+	// the next sequence is stored in *dest, its parent is owner (NULL for the first one of a group)
+	node_t** dest = root;
+	node_t* owner = NULL;
 
-	// peek if there is a '+' or a '*' behind
-	if (k == '*')
+	while (true)
 	{
-		
-		// allocate new kleene node between parent and left child
-		node_t* intermediate;
-		ERROR_RETHROW(
-			node_allocate(&intermediate, STAR),
-			tree_deinit(node)
-		);
-
-		intermediate->l_child = (*node)->l_child;
-		(*node)->l_child = intermediate;
-
-		// eat out eventual additional stars
-		do
+		char c, k;
+		bool escape = false;
+		node_t* node;
+
+		c = peek(regexpr, *regexpr_index);
+		if (c != '\0')
 		{
 			(void) eat(regexpr, regexpr_index);
 		}
-		while(peek(regexpr, *regexpr_index) == '*');
 
-	} // Otherwise check if there is a '+' ahead
-	else if (k == '+')
-	{
+		if (c == '\\')
+		{
+			escape = true;
+			if ((c = peek(regexpr, *regexpr_index)) != '\0')
+			{
+				(void) eat(regexpr, regexpr_index);
+			}
+		}
 
-		//this becomes a union node
-		(*node)->op = UNION;
-		(void) eat(regexpr, regexpr_index);
-	}
+		// END OF A SEQUENCE: at a ')' or at the end of the expression
+		if (c == '\0' || (!escape && c == ')'))
+		{
+			*dest = NULL;
 
-	// descend into right node
-	ERROR_RETHROW(
-		parser_recursive(&(*node)->r_child, regexpr, regexpr_index, false),
-		tree_deinit(node)
-	);
+			// a single element stands for itself
+			if (owner != NULL)
+			{
+				*owner = *owner->l_child;
+			}
 
-	// Backtrack if last node is null
-	if ((*node)->r_child == NULL)
-	{
-		node_t* temp = (*node)->l_child;
-		**node = *temp;
+			// a ')' out of any group ends the expression
+			if (groups_len == 0)
+			{
+				return OK;
+			}
 
-		node_deallocate(temp);
-	}
+			// the group continues as an element of the enclosing sequence
+			node = groups[--groups_len];
+			if (node->l_child == NULL)
+			{
+				return ILLFORMED_REGEXPR;
+			}
+		}
+		else if (!escape && (c == '+' || c == '*'))
+		{
+			return ILLFORMED_REGEXPR;
+		}
+		else if (!escape && c == '(')
+		{
+			k = peek(regexpr, *regexpr_index);
+			if (k == '+' || k == '*' || k == ')' || k == '\0')
+			{
+				return ILLFORMED_REGEXPR;
+			}
 
-	return OK;
+			// BEGINNING OF A GROUP: its content is the left child
+			ERROR_RETHROW(node_allocate(arena, &node, CONCAT));
+			*dest = node;
+			groups[groups_len++] = node;
+
+			dest = &node->l_child;
+			owner = NULL;
+			continue;
+		}
+		else
+		{
+			// CHARACTER OR CLASS
+			ERROR_RETHROW(node_allocate(arena, &node, CONCAT));
+			ERROR_RETHROW(node_allocate(arena, &node->l_child, NONE));
+			node->l_child->c = c;
+
+			if (!escape && c == '[')
+			{
+				node->l_child->op = SET;
+				ERROR_RETHROW(class_parse(node->l_child->set, regexpr, regexpr_index));
+			}
+
+			*dest = node;
+		}
+
+		// peek if there is a '+' or a '*' behind
+		k = peek(regexpr, *regexpr_index);
+		if (k == '*')
+		{
+			// allocate new kleene node between parent and left child
+			node_t* intermediate;
+			ERROR_RETHROW(node_allocate(arena, &intermediate, STAR));
+
+			intermediate->l_child = node->l_child;
+			node->l_child = intermediate;
+
+			// eat out eventual additional stars
+			do
+			{
+				(void) eat(regexpr, regexpr_index);
+			}
+			while(peek(regexpr, *regexpr_index) == '*');
+
+		} // Otherwise check if there is a '+' ahead
+		else if (k == '+')
+		{
+			//this becomes a union node
+			node->op = UNION;
+			(void) eat(regexpr, regexpr_index);
+		}
+
+		// the rest of the sequence is the right child
+		dest = &node->r_child;
+		owner = node;
+	}
 }
 
 int tree_graph(node_t* node){
@@ -236,10 +305,13 @@ static char graph_rec(node_t* node, FILE* f){
 		case STAR:
 			ch = '*';
 			break;
+		case SET:
+			ch = '[';
+			break;
 		default: return -1;
 	}
 	
-	if(node->op != NONE) 
+	if(node->op != NONE && node->op != SET) 
 		bg_color = "red";
 		
 	fprintf(f, "%ld [label=\"%c\", style=\"filled\", fillcolor=\"%s\", shape=\"oval\"]\n", (unsigned long)node, ch, bg_color);
@@ -255,17 +327,185 @@ static char graph_rec(node_t* node, FILE* f){
 	return ch;
 }
 
-static int node_allocate(node_t** node, op_t op){
+static int node_allocate(tree_arena_t* arena, node_t** node, op_t op){
 	assert(node != NULL);
-	
-	node_t* n;
-	if ((n = malloc(sizeof(node_t))) == NULL)
-		return BAD_ALLOCATION;
+
+	#ifdef _DEBUG
+	assert(arena->len < arena->capacity);
+	#endif
+
+	node_t* n = &arena->nodes[arena->len++];
 	
 	n->op = op;
+	n->c = '\0';
+	n->set[0] = 0;
+	n->set[1] = 0;
 	n->l_child = NULL;
 	n->r_child = NULL;
+	n->arena = arena;
 	*node = n;
 
 	return OK;
-}
\ No newline at end of file
+}
+
+// Parses the class following '[' up to its closing ']' into set
+static int class_parse(uint64_t* set, const char* regexpr, int* regexpr_index)
+{
+	bool complement = false;
+	if (peek(regexpr, *regexpr_index) == '^')
+	{
+		complement = true;
+		(void) eat(regexpr, regexpr_index);
+	}
+
+	// a leading ']' or '-' stands for itself
+	bool first = true;
+	while (first || peek(regexpr, *regexpr_index) != ']')
+	{
+		unsigned char low = (unsigned char) eat(regexpr, regexpr_index);
+		if (low == '\0')
+		{
+			return ILLFORMED_REGEXPR;
+		}
+
+		if (low == '\\' && (low = (unsigned char) eat(regexpr, regexpr_index)) == '\0')
+		{
+			return ILLFORMED_REGEXPR;
+		}
+
+		unsigned char high = low;
+
+		// RANGE, unless '-' is the last character of the class
+		if (peek(regexpr, *regexpr_index) == '-' && peek(regexpr, *regexpr_index + 1) != ']'
+			&& peek(regexpr, *regexpr_index + 1) != '\0')
+		{
+			(void) eat(regexpr, regexpr_index);
+
+			high = (unsigned char) eat(regexpr, regexpr_index);
+			if (high == '\\' && (high = (unsigned char) eat(regexpr, regexpr_index)) == '\0')
+			{
+				return ILLFORMED_REGEXPR;
+			}
+
+			if (high < low)
+			{
+				return ILLFORMED_REGEXPR;
+			}
+		}
+
+		if (high >= 128)
+		{
+			return ILLFORMED_REGEXPR;
+		}
+
+		class_add(set, low, high);
+		first = false;
+	}
+
+	// eat the ']'
+	(void) eat(regexpr, regexpr_index);
+
+	if (complement)
+	{
+		set[0] = ~set[0];
+		set[1] = ~set[1];
+
+		// the string terminator is never matched
+		set[0] &= ~(uint64_t) 1;
+	}
+
+	if (set[0] == 0 && set[1] == 0)
+	{
+		return ILLFORMED_REGEXPR;
+	}
+
+	return OK;
+}
+
+// Adds the characters from low to high to set
+static void class_add(uint64_t* set, unsigned char low, unsigned char high)
+{
+	unsigned int c;
+	for (c=low; c<=high; ++c)
+	{
+		set[c / 64] |= (uint64_t) 1 << (c % 64);
+	}
+}
+
+// Characters and classes, matching a single character
+static bool node_is_leaf(const node_t* node)
+{
+	return node->op == NONE || node->op == SET;
+}
+
+// Turns node into the SET of its characters and those of leaf
+static void node_merge(node_t* node, const node_t* leaf)
+{
+	if (node->op == NONE)
+	{
+		node->op = SET;
+		node->set[0] = 0;
+		node->set[1] = 0;
+		class_add(node->set, (unsigned char) node->c, (unsigned char) node->c);
+	}
+	else if (node->op != SET)
+	{
+		node->op = SET;
+		node->set[0] = 0;
+		node->set[1] = 0;
+	}
+
+	if (leaf->op == NONE)
+	{
+		class_add(node->set, (unsigned char) leaf->c, (unsigned char) leaf->c);
+	}
+	else
+	{
+		node->set[0] |= leaf->set[0];
+		node->set[1] |= leaf->set[1];
+	}
+}
+
+// Rewrites a star or a union whose children are already optimized
+static void node_fold(node_t** node)
+{
+	node_t* n = *node;
+	node_t* temp;
+
+	// x** is x*
+	if (n->op == STAR)
+	{
+		if (n->l_child->op == STAR)
+		{
+			n->l_child = n->l_child->l_child;
+		}
+		return;
+	}
+
+	// FOLD: the characters of a union chain gather in the set at its head
+	if (!node_is_leaf(n->l_child) && node_is_leaf(n->r_child))
+	{
+		temp = n->l_child;
+		n->l_child = n->r_child;
+		n->r_child = temp;
+	}
+	else if (!node_is_leaf(n->l_child) && n->r_child->op == UNION && node_is_leaf(n->r_child->l_child))
+	{
+		temp = n->l_child;
+		n->l_child = n->r_child->l_child;
+		n->r_child->l_child = temp;
+	}
+
+	if (node_is_leaf(n->l_child) && node_is_leaf(n->r_child))
+	{
+		node_merge(n, n->l_child);
+		node_merge(n, n->r_child);
+		n->l_child = NULL;
+		n->r_child = NULL;
+	}
+	else if (node_is_leaf(n->l_child) && n->r_child->op == UNION && node_is_leaf(n->r_child->l_child))
+	{
+		node_merge(n->r_child->l_child, n->l_child);
+		*node = n->r_child;
+	}
+}
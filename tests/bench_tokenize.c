@@ -0,0 +1,139 @@
+#include <compiler_errors.h>
+#include <lexer.h>
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Benchmarking tokenize: the time per byte stays the same from 1 MB to 10 MB, whatever the length of the tokens */
+
+#define MB ((size_t) 1 << 20)
+
+static const char statement[] = "result := add(first_operand, 101, \"a string\");\n";
+
+// Fills buffer with len characters of short tokens, or of names of token_len characters
+static void fill(char* buffer, size_t len, size_t token_len)
+{
+    size_t i;
+    for (i=0; i<len; ++i)
+    {
+        if (token_len == 0)
+        {
+            buffer[i] = statement[i % (sizeof(statement) - 1)];
+        }
+        else
+        {
+            buffer[i] = (i % (token_len + 1) == token_len) ? ' ' : 'n';
+        }
+    }
+
+    // a name may not end with the buffer: the last token is a delimiter
+    buffer[len - 1] = '\n';
+    buffer[len] = '\0';
+}
+
+// Statements generated a chunk at a time: the input of tokenize_stream is never held whole
+typedef struct _generator{
+    size_t len;
+    size_t generated;
+} generator_t;
+
+static ssize_t generate(void* source, char* buffer, size_t len)
+{
+    generator_t* generator = source;
+
+    size_t left = generator->len - generator->generated;
+    size_t n = (len < left) ? len : left;
+    size_t i;
+    for (i=0; i<n; ++i)
+    {
+        buffer[i] = statement[(generator->generated + i) % (sizeof(statement) - 1)];
+    }
+
+    generator->generated += n;
+    return (ssize_t) n;
+}
+
+static int count(void* context, toktype_t tt, const char* tk, size_t len)
+{
+    (void) tt;
+    (void) tk;
+    (void) len;
+
+    ++*(size_t*) context;
+    return OK;
+}
+
+static double seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+int main()
+{
+    static const size_t sizes[] = {1 * MB, 2 * MB, 5 * MB, 10 * MB};
+    static const size_t token_lens[] = {0, 64 * 1024, MB};
+
+    char* buffer;
+    if ((buffer = malloc(10 * MB + 1)) == NULL)
+    {
+        return BAD_ALLOCATION;
+    }
+
+    toklist_t token_list;
+    ERROR_RETHROW(tokenizer_init_builtin(&token_list), free(buffer));
+
+    printf("%-12s %8s %10s %10s %10s\n", "tokens", "MB", "tokens", "seconds", "ns/byte");
+
+    size_t k, i;
+    for (k=0; k<sizeof(token_lens) / sizeof(token_lens[0]); ++k)
+    {
+        double first = 0, last = 0;
+        for (i=0; i<sizeof(sizes) / sizeof(sizes[0]); ++i)
+        {
+            fill(buffer, sizes[i], token_lens[k]);
+
+            // the tokens of the previous run are freed outside of the measure
+            ERROR_RETHROW(tokenize(&token_list, "\n"), tokenizer_deinit(&token_list); free(buffer));
+
+            double start = seconds();
+            ERROR_RETHROW(tokenize(&token_list, buffer), tokenizer_deinit(&token_list); free(buffer));
+            double elapsed = seconds() - start;
+
+            double per_byte = elapsed * 1e9 / (double) sizes[i];
+            first = (i == 0) ? per_byte : first;
+            last = per_byte;
+
+            char name[32];
+            snprintf(name, sizeof(name), (token_lens[k] == 0) ? "statements" : "names %luK", token_lens[k] / 1024);
+            printf("%-12s %8lu %10lu %10.3f %10.2f\n", name, sizes[i] / MB, token_list.list_size, elapsed, per_byte);
+        }
+
+        // linear: about 1, quadratic in the length of the tokens: about 10 for the long names
+        printf("time per byte, 10 MB / 1 MB: %.2f\n\n", last / first);
+    }
+
+    // streamed: a window of a chunk instead of the whole buffer
+    double first = 0, last = 0;
+    for (i=0; i<sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        generator_t generator = {sizes[i] - (sizes[i] % (sizeof(statement) - 1)), 0};
+        size_t tokens = 0;
+
+        double start = seconds();
+        ERROR_RETHROW(tokenize_stream(&token_list, generate, &generator, count, &tokens), tokenizer_deinit(&token_list); free(buffer));
+        double elapsed = seconds() - start;
+
+        double per_byte = elapsed * 1e9 / (double) sizes[i];
+        first = (i == 0) ? per_byte : first;
+        last = per_byte;
+
+        printf("%-12s %8lu %10lu %10.3f %10.2f\n", "streamed", sizes[i] / MB, tokens, elapsed, per_byte);
+    }
+    printf("time per byte, 10 MB / 1 MB: %.2f\n", last / first);
+
+    tokenizer_deinit(&token_list);
+    free(buffer);
+    return 0;
+}
@@ -1,43 +1,234 @@
 #include <nfa_builder.h>
+#include <dfa_builder.h>
 #include <regexparse.h>
 #include <compiler_errors.h>
+#include <unistd.h>
 
 #define REGEXBUFFER_LEN (sizeof(regex_buffer) / sizeof(regex_buffer[0]))
 
+// Builder options, part of the key of a cached automaton
+#define BUILD_MINIMIZED 1u
+#define BUILD_REDUCED 2u
+#define BUILD_GLUSHKOV 4u
+#define BUILD_LAYOUT 8u
+
 static const char* regex_buffer[] = { 
 				"\n+\t+ ",
 				":=",
 				"\\(",
 				"\\)",
-				"[",
-				"]",
+				"\\[",
+				"\\]",
 				";",
 				",",
-				"(0+1+2+3+4+5+6+7+8+9)(0+1+2+3+4+5+6+7+8+9)*",
-				"(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+$+_)(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_)*",
-				"\"((a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_+\\\\+/+ +\\\\n+<+>+&+\\++-+#+[+]+=+:+?+^+,+.+;+\\*)*)\"",
- 				"'(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_+\\\\+/+ +\\\\n+<+>+&+\\++-+#+[+]+=+:+?+^+,+.+;+\\*)'",
+				"[0-9][0-9]*",
+				"[a-zA-CE-IL-Z$_][a-zA-CE-IL-Z0-9$_]*",
+				"\"([a-zA-CE-IL-Z0-9$_\\\\/ ]+\\\\[n<>&+#\\[\\]=:?^,.;*-])*\"",
+				"'([a-zA-CE-IL-Z0-9$_\\\\/ ]+\\\\[n<>&+#\\[\\]=:?^,.;*-])'",
 				
 				//trash
- 				":+'+\"+('(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_+\\\\+/+ +\\\\n+<+>+&+\\++-+#+[+]+=+:+?+^+,+.+;+\\*))+(\"(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_+\\\\+/+ +\\\\n+<+>+&+\\++-+#+[+]+=+:+?+^+,+.+;+\\*)*)"
+				":+'+\"+('([a-zA-CE-IL-Z0-9$_\\\\/ ]+\\\\[n<>&+#\\[\\]=:?^,.;*-]))+(\"([a-zA-CE-IL-Z0-9$_\\\\/ ]+\\\\[n<>&+#\\[\\]=:?^,.;*-])*)"
 };
 
-int main()
+// Replaces the NFA with its minimal DFA
+static int minimize(nfa_t* nfa)
+{
+    dfa_t dfa;
+    ERROR_RETHROW(dfa_from_nfa(&dfa, nfa));
+    ERROR_RETHROW(dfa_minimize(&dfa), dfa_destroy(&dfa));
+
+    nfa_t minimal;
+    ERROR_RETHROW(dfa_to_nfa(&minimal, &dfa), dfa_destroy(&dfa));
+    dfa_destroy(&dfa);
+
+    nfa_destroy(nfa);
+    *nfa = minimal;
+    return OK;
+}
+
+// Writes the minimal tagged DFA of the collection, as tokenizer_init would build it, as C tables and/or as a direct-coded scanner
+static int generate(const nfa_t* collection, size_t count, const char* tables_path, const char* scanner_path)
+{
+    unsigned char class_map[ASCII_LEN];
+    size_t classes_len;
+    ERROR_RETHROW(nfa_collection_classes(collection, count, class_map, &classes_len));
+
+    nfa_t merged;
+    ERROR_RETHROW(nfa_collection_merge(&merged, collection, count));
+
+    dfa_t dfa;
+    ERROR_RETHROW(dfa_from_nfa(&dfa, &merged), nfa_destroy(&merged));
+    nfa_destroy(&merged);
+
+    ERROR_RETHROW(dfa_compress(&dfa, class_map, classes_len), dfa_destroy(&dfa));
+    ERROR_RETHROW(dfa_minimize(&dfa), dfa_destroy(&dfa));
+
+    if (tables_path != NULL)
+    {
+        ERROR_RETHROW(dfa_generate(&dfa, "token_dfa", tables_path), dfa_destroy(&dfa));
+        printf("%lu states, %lu byte classes written to %s.c\n", dfa.states_len, classes_len, tables_path);
+    }
+
+    if (scanner_path != NULL)
+    {
+        ERROR_RETHROW(dfa_generate_scanner(&dfa, "token_scan", scanner_path), dfa_destroy(&dfa));
+        printf("%lu states written to %s.c\n", dfa.states_len, scanner_path);
+    }
+
+    dfa_destroy(&dfa);
+    return OK;
+}
+
+// Compiles the i-th regex of the collection with the given options
+static int compile(nfa_t* nfa, const char* regex, uint32_t options, size_t i)
+{
+    node_t* tree;
+    ERROR_RETHROW(tree_parse(&tree, regex));
+    ERROR_RETHROW(tree_optimize(&tree), tree_deinit(&tree));
+
+    if (options & BUILD_GLUSHKOV)
+    {
+        ERROR_RETHROW(nfa_build_glushkov(nfa, tree), tree_deinit(&tree));
+    }
+    else
+    {
+        ERROR_RETHROW(nfa_build(nfa, tree), tree_deinit(&tree));
+    }
+    tree_deinit(&tree);
+
+    ERROR_RETHROW(nfa_trim(nfa), nfa_destroy(nfa));
+
+    if (options & BUILD_REDUCED)
+    {
+        size_t states_len = nfa->states_len;
+        ERROR_RETHROW(nfa_reduce(nfa), nfa_destroy(nfa));
+
+        printf("[%lu] %lu states -> %lu states (reduced)\n", i, states_len, nfa->states_len);
+    }
+
+    if (options & BUILD_MINIMIZED)
+    {
+        size_t states_len = nfa->states_len;
+        ERROR_RETHROW(minimize(nfa), nfa_destroy(nfa));
+
+        printf("[%lu] %lu states -> %lu states\n", i, states_len, nfa->states_len);
+    }
+
+    if (options & BUILD_LAYOUT)
+    {
+        ERROR_RETHROW(nfa_layout(nfa, NULL), nfa_destroy(nfa));
+    }
+
+    return OK;
+}
+
+/*
+    USAGE: build_collection [-m] [-r] [-g] [-l] [-d directory] [-c path] [-s path]
+    -m  minimize every automaton before saving it
+    -r  merge the bisimilar states of every automaton, keeping it nondeterministic
+    -g  build the position automata in a single pass (nfa_build_glushkov)
+    -l  renumber the states of every automaton breadth-first, so that the states met first are saved together
+    -d  cache the compiled automata in directory, so that only the changed regexes are compiled again
+    -c  write the token tables as C source to path.c and path.h instead of saving the collection
+    -s  write the direct-coded token scanner to path.c and path.h instead of saving the collection
+*/
+int main(int argc, char** argv)
 {
     nfa_t collection[REGEXBUFFER_LEN];
+    bool minimized = false;
+    bool reduced = false;
+    bool glushkov = false;
+    bool layout = false;
+    const char* tables_path = NULL;
+    const char* scanner_path = NULL;
+    const char* cache_directory = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "mrgld:c:s:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                minimized = true;
+                break;
+
+            case 'r':
+                reduced = true;
+                break;
+
+            case 'g':
+                glushkov = true;
+                break;
+
+            case 'l':
+                layout = true;
+                break;
+
+            case 'd':
+                cache_directory = optarg;
+                break;
+
+            case 'c':
+                tables_path = optarg;
+                break;
+
+            case 's':
+                scanner_path = optarg;
+                break;
+
+            default:
+                fprintf(stderr, "USAGE: %s [-m] [-r] [-g] [-l] [-d directory] [-c path] [-s path]\n", argv[0]);
+                return -1;
+        }
+    }
+
+    uint32_t options = (minimized ? BUILD_MINIMIZED : 0) | (reduced ? BUILD_REDUCED : 0) | (glushkov ? BUILD_GLUSHKOV : 0)
+        | (layout ? BUILD_LAYOUT : 0);
+    size_t cached = 0;
 
     size_t i;
     for (i=0; i<REGEXBUFFER_LEN; ++i)
     {
-        node_t* tree;
-        ERROR_RETHROW(tree_parse(&tree, regex_buffer[i]));
+        // only the regexes missing from the cache are compiled
+        uint64_t key = nfa_cache_key(regex_buffer[i], options);
+        if (cache_directory != NULL && nfa_cache_load(&collection[i], cache_directory, key) == OK)
+        {
+            ++cached;
+            continue;
+        }
+
+        ERROR_RETHROW(compile(&collection[i], regex_buffer[i], options, i));
+
+        if (cache_directory != NULL)
+        {
+            ERROR_RETHROW(nfa_cache_store(&collection[i], cache_directory, key));
+        }
+    }
+
+    if (cache_directory != NULL)
+    {
+        printf("%lu of %lu automata from the cache\n", cached, REGEXBUFFER_LEN);
+    }
 
-        ERROR_RETHROW(nfa_build(&collection[i], tree));
-        tree_deinit(&tree);
+    if (tables_path != NULL || scanner_path != NULL)
+    {
+        int err = generate(collection, REGEXBUFFER_LEN, tables_path, scanner_path);
+
+        for (i=0; i<REGEXBUFFER_LEN; ++i)
+        {
+            nfa_destroy(&collection[i]);
+        }
+
+        return err;
     }
 
     ERROR_RETHROW(nfa_collection_save(collection, REGEXBUFFER_LEN, "nfa_collection.dat"));
 
+    unsigned char class_map[ASCII_LEN];
+    size_t classes_len;
+    ERROR_RETHROW(nfa_collection_classes(collection, REGEXBUFFER_LEN, class_map, &classes_len));
+    printf("%lu byte classes\n", classes_len);
+
     for (i=0; i<REGEXBUFFER_LEN; ++i)
     {
         nfa_destroy(&collection[i]);
@@ -9,50 +9,30 @@ int main(int argc, char** argv)
 {
     if (argc < 2)
     {
-        fprintf(stdout, "USAGE: tomc <textfile>\n");
+        fprintf(stdout, "USAGE: tomc <textfile> (- for the standard input)\n");
         return -1;
     }
     
     const char* filename = argv[1];
 
-    int fd;
-    if ((fd = open(filename, O_RDONLY)) == -1)
+    int fd = STDIN_FILENO;
+    if (strcmp(filename, "-") != 0 && (fd = open(filename, O_RDONLY)) == -1)
     {
         fprintf(stderr, "FILE: %s, LINE: %d\n", __FILE__, __LINE__);
         return -1;
     }
 
-    if (lseek(fd, 0, SEEK_END) == -1)
-    {
-        close(fd);
-        fprintf(stderr, "FILE: %s, LINE: %d\n", __FILE__, __LINE__);
-        return -1;
-    }
-
-    size_t length = lseek(fd, 0, SEEK_CUR);
-    lseek(fd, 0, SEEK_SET);
-
-    char buffer[length+1];
-    bzero(buffer, length+1);
-
-    if (read(fd, buffer, sizeof(char) * length) < (ssize_t) (sizeof(char) * length))
-    {
-        close(fd);
-        fprintf(stderr, "FILE: %s, LINE: %d\n", __FILE__, __LINE__);
-        return -1;
-    }
-
-    close(fd);
-
     interpreter_init();
     toklist_t token_list = {0};
     ast_t ast = {0};
 
-    // tokenize the buffer
-    ERROR_RETHROW(tokenizer_init(&token_list, "nfa_collection.dat"));
-    ERROR_RETHROW(tokenize(&token_list, buffer),
+    // tokenize the file as it is read, in chunks
+    ERROR_RETHROW(tokenizer_init_builtin(&token_list), close(fd));
+    ERROR_RETHROW(tokenize_fd(&token_list, fd),
+        close(fd);
         tokenizer_deinit(&token_list)
     );
+    close(fd);
 
     ERROR_RETHROW(parser_ast(&ast, &token_list),
         tokenizer_deinit(&token_list)
@@ -9,8 +9,8 @@
 static const char* regex_buffer[] = { 
 				"(0+1+2+3+4+5+6+7+8+9)(0+1+2+3+4+5+6+7+8+9)*",
 				"(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+$+_)((a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_)*)",
-				"\"((a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_+\\\\+/+ +<+>+&+\\++-+#+[+]+=+:+?+^+,+.+;+\\*)*)\"",
-                ":+'+\"+('(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_+\\\\+/+ +<+>+&+\\++-+#+[+]+=+:+?+^+,+.+;+\\*))+(\"(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_+\\\\+/+ +<+>+&+\\++-+#+[+]+=+:+?+^+,+.+;+\\*)*)"
+				"\"((a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_+\\\\+/+ +<+>+&+\\++-+#+\\[+\\]+=+:+?+^+,+.+;+\\*)*)\"",
+                ":+'+\"+('(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_+\\\\+/+ +<+>+&+\\++-+#+\\[+\\]+=+:+?+^+,+.+;+\\*))+(\"(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_+\\\\+/+ +<+>+&+\\++-+#+\\[+\\]+=+:+?+^+,+.+;+\\*)*)"
 };
 
 void check_tree_integrity(const node_t* tree)
@@ -18,9 +18,10 @@ void check_tree_integrity(const node_t* tree)
 
     assert(tree != NULL);
 
-    assert(tree->op >= NONE && tree->op <= STAR);
+    assert(tree->op >= NONE && tree->op <= SET);
 
     assert(tree->op != NONE || (tree->c > 0 && tree->c < 128));
+    assert(tree->op != SET || tree->set[0] != 0 || tree->set[1] != 0);
 
     if (tree->op == CONCAT || tree->op == UNION)
     {
@@ -59,6 +60,127 @@ void test_regexpr()
     }
 }
 
+static bool set_contains(const node_t* node, unsigned char c)
+{
+    return (node->set[c / 64] >> (c % 64)) & 1;
+}
+
+void test_class()
+{
+    node_t* node;
+
+    assert(tree_parse(&node, "[a-cx]") == OK);
+    assert(node->op == SET);
+    assert(set_contains(node, 'a') && set_contains(node, 'b') && set_contains(node, 'c'));
+    assert(set_contains(node, 'x') && !set_contains(node, 'd'));
+    tree_deinit(&node);
+
+    // complement, never containing the string terminator
+    assert(tree_parse(&node, "[^a]") == OK);
+    assert(!set_contains(node, 'a') && set_contains(node, 'b') && !set_contains(node, '\0'));
+    tree_deinit(&node);
+
+    // literal ']', '-' and escapes
+    assert(tree_parse(&node, "[]a-]") == OK);
+    assert(set_contains(node, ']') && set_contains(node, 'a') && set_contains(node, '-'));
+    tree_deinit(&node);
+
+    assert(tree_parse(&node, "[\\]\\-]") == OK);
+    assert(set_contains(node, ']') && set_contains(node, '-') && !set_contains(node, '\\'));
+    tree_deinit(&node);
+
+    // a class behaves as a character
+    assert(tree_parse(&node, "x[0-9]*[a-z]+y") == OK);
+    check_tree_integrity(node);
+    tree_deinit(&node);
+
+    assert(tree_parse(&node, "\\[") == OK);
+    assert(node->op == NONE && node->c == '[');
+    tree_deinit(&node);
+
+    assert(tree_parse(&node, "[a-") == ILLFORMED_REGEXPR);
+    assert(tree_parse(&node, "[z-a]") == ILLFORMED_REGEXPR);
+    assert(tree_parse(&node, "[^\x01-\x7f]") == ILLFORMED_REGEXPR);
+}
+
+void test_tree_optimize()
+{
+    node_t* node;
+    node_t* class;
+
+    // a union of characters becomes the class
+    assert(tree_parse(&node, "a+b+c+\\++x") == OK);
+    assert(tree_optimize(&node) == OK);
+    assert(tree_parse(&class, "[a-cx+]") == OK);
+    assert(node->op == SET);
+    assert(node->set[0] == class->set[0] && node->set[1] == class->set[1]);
+    tree_deinit(&node);
+    tree_deinit(&class);
+
+    // characters are gathered around the other alternatives, groups are flattened
+    assert(tree_parse(&node, "(a+b)+(cd)+e") == OK);
+    assert(tree_optimize(&node) == OK);
+    check_tree_integrity(node);
+    assert(node->op == UNION);
+    assert(node->l_child->op == SET && node->r_child->op == CONCAT);
+    assert(tree_parse(&class, "[abe]") == OK);
+    assert(node->l_child->set[0] == class->set[0] && node->l_child->set[1] == class->set[1]);
+    tree_deinit(&node);
+    tree_deinit(&class);
+
+    assert(tree_parse(&node, "((a*)*)b") == OK);
+    assert(tree_optimize(&node) == OK);
+    assert(node->op == CONCAT && node->l_child->op == STAR && node->l_child->l_child->op == NONE);
+    tree_deinit(&node);
+
+    // the spelled out regexes
+    int i;
+    for (i=0; i<4; ++i)
+    {
+        assert(tree_parse(&node, regex_buffer[i]) == OK);
+        assert(tree_optimize(&node) == OK);
+        check_tree_integrity(node);
+        tree_deinit(&node);
+    }
+}
+
+void test_long_regexpr()
+{
+    // deeper than any recursive parser could go
+    static char regexpr[1 << 18];
+    size_t depth = sizeof(regexpr) / 4, i;
+
+    for (i=0; i<depth; ++i)
+    {
+        regexpr[i] = '(';
+        regexpr[depth + 2 * i] = 'a';
+        regexpr[depth + 2 * i + 1] = ')';
+    }
+    regexpr[3 * depth] = '\0';
+
+    node_t* node;
+    assert(tree_parse(&node, regexpr) == OK);
+    assert(node->op == CONCAT);
+    assert(node->arena->len <= node->arena->capacity);
+    tree_deinit(&node);
+    assert(node == NULL);
+
+    // a long sequence of characters, stars and unions
+    for (i=0; i<sizeof(regexpr) - 1; ++i)
+    {
+        regexpr[i] = (i % 3 == 2) ? ((i % 2) ? '*' : '+') : (char) ('a' + i % 26);
+    }
+    regexpr[sizeof(regexpr) - 1] = '\0';
+
+    assert(tree_parse(&node, regexpr) == OK);
+    check_tree_integrity(node);
+    tree_deinit(&node);
+
+    // ill-formed groups are rejected
+    assert(tree_parse(&node, "()") == ILLFORMED_REGEXPR);
+    assert(tree_parse(&node, "a(\\") == ILLFORMED_REGEXPR);
+}
+
 int main(){
     printf("[*] Test Regexpr:\n");
     
@@ -66,6 +188,23 @@ int main(){
     
     printf("[+] Test Successful\n");
 
-    
+    printf("[*] Test character classes:\n");
+
+    test_class();
+
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test long regular expressions:\n");
+
+    test_long_regexpr();
+
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test tree_optimize:\n");
+
+    test_tree_optimize();
+
+    printf("[+] Test Successful\n");
+
     return 0;
 }
\ No newline at end of file
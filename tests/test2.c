@@ -1,15 +1,20 @@
 #include <nfa_builder.h>
+#include <dfa_builder.h>
 #include <regexparse.h>
 #include <compiler_errors.h>
 #include <assert.h>
+#include <pthread.h>
+#include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 static const char* regex_buffer[] = { 
 				"(0+1+2+3+4+5+6+7+8+9)((0+1+2+3+4+5+6+7+8+9)*)",
 				"(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+$+_)((a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_)*)",
-				":+\"(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_+\\\\+/+ +<+>+&+\\++-+#+[+]+=+:+?+^+,+.+;+\\*)*",
+				":+\"(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_+\\\\+/+ +<+>+&+\\++-+#+\\[+\\]+=+:+?+^+,+.+;+\\*)*",
 
-                ":+'+\"+('(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_+\\\\+/+ +<+>+&+\\++-+#+[+]+=+:+?+^+,+.+;+\\*))+(\"(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_+\\\\+/+ +<+>+&+\\++-+#+[+]+=+:+?+^+,+.+;+\\*)*)"
+                ":+'+\"+('(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_+\\\\+/+ +<+>+&+\\++-+#+\\[+\\]+=+:+?+^+,+.+;+\\*))+(\"(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_+\\\\+/+ +<+>+&+\\++-+#+\\[+\\]+=+:+?+^+,+.+;+\\*)*)"
 };
 
 static node_t* node[4];
@@ -109,6 +114,541 @@ void test_nfa_accepts()
 
 }
 
+void test_nfa_accepts_long()
+{
+    // a long string literal: the active set stays bounded by the number of states
+    static char string[1 << 16];
+    memset(string, 'a', sizeof(string) - 1);
+    string[0] = '"';
+    string[sizeof(string) - 1] = '\0';
+
+    nfa_t* nfa = &nfa_collection[2];
+    bool result = false;
+    assert(nfa_accepts(nfa, string, &result) == OK);
+    assert(result == true);
+
+    match_t match;
+    assert(match_begin(&match, nfa) == OK);
+    result = false;
+    assert(match_accepts(&match, string, &result) == OK);
+    assert(result == true);
+    assert(match.states_len <= nfa->states_len);
+
+    // duplicate successors are merged
+    size_t i, j;
+    for (i=0; i<match.states_len; ++i)
+    {
+        for (j=i+1; j<match.states_len; ++j)
+        {
+            assert(match.states[i] != match.states[j]);
+        }
+    }
+    match_end(&match);
+
+    string[1] = '\n';
+    assert(nfa_accepts(nfa, string, &result) == OK);
+    assert(result == false);
+}
+
+void test_match()
+{
+    static const char* strings[] = {"110", "00ab", "_$name$_", "00name", "\"go on", ":x", "I am not a string"};
+
+    size_t i, j, k;
+    for (i=0; i<4; ++i)
+    {
+        match_t match;
+        assert(match_begin(&match, &nfa_collection[i]) == OK);
+
+        for (j=0; j<sizeof(strings) / sizeof(strings[0]); ++j)
+        {
+            char prefix[32] = {0};
+            match_reset(&match);
+
+            // every prefix is accepted by the match iff nfa_accepts accepts it
+            for (k=0; strings[j][k] != '\0'; ++k)
+            {
+                bool result;
+
+                match_feed(&match, strings[j][k]);
+                prefix[k] = strings[j][k];
+
+                assert(nfa_accepts(&nfa_collection[i], prefix, &result) == OK);
+                assert(match_is_accepting(&match) == result);
+                assert(!match_is_dead(&match) || !result);
+            }
+        }
+
+        match_end(&match);
+    }
+
+    // a number cannot start with a letter
+    match_t match;
+    assert(match_begin(&match, &nfa_collection[0]) == OK);
+    match_feed(&match, '1');
+    assert(!match_is_dead(&match));
+    assert(match_is_accepting(&match));
+    match_feed(&match, 'a');
+    assert(match_is_dead(&match));
+    assert(!match_is_accepting(&match));
+    match_feed(&match, '1');
+    assert(match_is_dead(&match));
+    match_end(&match);
+}
+
+#define SHARED_THREADS 4
+
+static const char* shared_strings[] = {"0", "1234", "abc", "a1", ":", "\"g", "'x'", "", "#"};
+static bool shared_expected[4][sizeof(shared_strings) / sizeof(shared_strings[0])];
+
+// Matches the strings on every NFA of the collection with match contexts of its own
+static void* match_shared(void* arg)
+{
+    (void) arg;
+
+    size_t i;
+    for (i=0; i<4; ++i)
+    {
+        match_t match;
+        assert(match_begin(&match, &nfa_collection[i]) == OK);
+
+        size_t k;
+        for (k=0; k<256; ++k)
+        {
+            size_t j;
+            for (j=0; j<sizeof(shared_strings) / sizeof(shared_strings[0]); ++j)
+            {
+                bool result = !shared_expected[i][j];
+                assert(match_accepts(&match, shared_strings[j], &result) == OK);
+                assert(result == shared_expected[i][j]);
+
+                result = !shared_expected[i][j];
+                assert(nfa_accepts(&nfa_collection[i], shared_strings[j], &result) == OK);
+                assert(result == shared_expected[i][j]);
+            }
+        }
+
+        match_end(&match);
+    }
+
+    return NULL;
+}
+
+void test_nfa_accepts_batch()
+{
+    const size_t len = sizeof(shared_strings) / sizeof(shared_strings[0]);
+
+    size_t i;
+    for (i=0; i<4; ++i)
+    {
+        bool results[len];
+        assert(nfa_accepts_batch(&nfa_collection[i], shared_strings, len, results) == OK);
+
+        size_t j;
+        for (j=0; j<len; ++j)
+        {
+            bool expected;
+            assert(nfa_accepts(&nfa_collection[i], shared_strings[j], &expected) == OK);
+            assert(results[j] == expected);
+        }
+    }
+}
+
+// Several threads match at once on the same NFAs
+void test_match_shared()
+{
+    size_t i, j;
+    for (i=0; i<4; ++i)
+    {
+        for (j=0; j<sizeof(shared_strings) / sizeof(shared_strings[0]); ++j)
+        {
+            assert(nfa_accepts(&nfa_collection[i], shared_strings[j], &shared_expected[i][j]) == OK);
+        }
+    }
+
+    pthread_t threads[SHARED_THREADS];
+    for (i=0; i<SHARED_THREADS; ++i)
+    {
+        assert(pthread_create(&threads[i], NULL, match_shared, NULL) == 0);
+    }
+
+    for (i=0; i<SHARED_THREADS; ++i)
+    {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+}
+
+void test_nfa_compact()
+{
+    size_t i;
+    for (i=0; i<4; ++i)
+    {
+        assert(nfa_compact(&nfa_collection[i]) == OK);
+
+        size_t j;
+        for (j=0; j<nfa_collection[i].states_len; ++j)
+        {
+            const state_t* state = &nfa_collection[i].states[j];
+            assert(state->len == 0 || state->row != NULL);
+
+            // deterministic iff no character repeats in the charset, to live states
+            size_t k, l;
+            bool deterministic = true;
+            for (k=0; k<state->len; ++k)
+            {
+                for (l=k+1; l<state->len; ++l)
+                {
+                    deterministic = deterministic
+                        && (state->charset[k] != state->charset[l]
+                            || nfa_collection[i].states[state->mapped_state[k]].dead
+                            || nfa_collection[i].states[state->mapped_state[l]].dead);
+                }
+            }
+
+            assert(state->len == 0 || state->deterministic == deterministic);
+        }
+
+        // built NFAs are small and every state is entered on one character
+        assert(nfa_collection[i].parallel != NULL);
+    }
+
+    // same results through the dense index and the bit-parallel simulation
+    test_nfa_accepts();
+    test_match();
+}
+
+void test_nfa_set()
+{
+    // the identifiers of regex_buffer[1], as classes
+    node_t* tree;
+    nfa_t nfa;
+    assert(tree_parse(&tree, "[a-zA-CE-IL-Z$_][a-zA-CE-IL-Z0-9$_]*") == OK);
+    assert(nfa_build(&nfa, tree) == OK);
+    tree_deinit(&tree);
+
+    assert(nfa.states_len == 3);
+    assert(nfa.states_len < nfa_collection[1].states_len);
+
+    static const char* strings[] = {"", "a", "abc", "_x1$", "1abc", "D", "aD", "Zz09", "a b"};
+    size_t i;
+    for (i=0; i<sizeof(strings) / sizeof(strings[0]); ++i)
+    {
+        bool expected, result;
+        assert(nfa_accepts(&nfa_collection[1], strings[i], &expected) == OK);
+        assert(nfa_accepts(&nfa, strings[i], &result) == OK);
+        assert(result == expected);
+    }
+
+    // states entered on a whole class still allow the bit-parallel tables
+    assert(nfa_compact(&nfa) == OK);
+    assert(nfa.parallel != NULL);
+    for (i=0; i<sizeof(strings) / sizeof(strings[0]); ++i)
+    {
+        bool expected, result;
+        assert(nfa_accepts(&nfa_collection[1], strings[i], &expected) == OK);
+        assert(nfa_accepts(&nfa, strings[i], &result) == OK);
+        assert(result == expected);
+    }
+
+    nfa_destroy(&nfa);
+
+    // the same identifiers spelled out, once optimized
+    assert(tree_parse(&tree, regex_buffer[1]) == OK);
+    assert(tree_optimize(&tree) == OK);
+    assert(nfa_build(&nfa, tree) == OK);
+    tree_deinit(&tree);
+
+    assert(nfa.states_len == 3);
+    for (i=0; i<sizeof(strings) / sizeof(strings[0]); ++i)
+    {
+        bool expected, result;
+        assert(nfa_accepts(&nfa_collection[1], strings[i], &expected) == OK);
+        assert(nfa_accepts(&nfa, strings[i], &result) == OK);
+        assert(result == expected);
+    }
+
+    nfa_destroy(&nfa);
+}
+
+void test_nfa_build_glushkov()
+{
+    static const char* regexes[] = {"(ab+a)*(b+ba)*", "((a+b)*a)(a+b)(a+b)", "((a*)*b)*", "a+(b*c)*"};
+    static const char* strings[] = {"", "110", "00ab", "_$name$_", "00name", "\"go on", ":x", "I am not a string"};
+
+    // the collection regexes, on sample strings
+    size_t i, j;
+    for (i=0; i<4; ++i)
+    {
+        nfa_t nfa;
+        assert(nfa_build_glushkov(&nfa, node[i]) == OK);
+
+        for (j=0; j<sizeof(strings) / sizeof(strings[0]); ++j)
+        {
+            bool expected, result;
+            assert(nfa_accepts(&nfa_collection[i], strings[j], &expected) == OK);
+            assert(nfa_accepts(&nfa, strings[j], &result) == OK);
+            assert(result == expected);
+        }
+
+        assert(nfa.states_len <= nfa_collection[i].states_len);
+        nfa_destroy(&nfa);
+    }
+
+    // regexes over {a, b, c}, on every string of length < 7
+    for (i=0; i<sizeof(regexes) / sizeof(regexes[0]); ++i)
+    {
+        node_t* tree;
+        nfa_t expected_nfa, nfa;
+        assert(tree_parse(&tree, regexes[i]) == OK);
+        assert(nfa_build(&expected_nfa, tree) == OK);
+        assert(nfa_build_glushkov(&nfa, tree) == OK);
+        tree_deinit(&tree);
+
+        char string[7];
+        size_t len, code, count;
+        for (len=0, count=1; len<sizeof(string); ++len, count *= 3)
+        {
+            for (code=0; code<count; ++code)
+            {
+                size_t k, rest = code;
+                for (k=0; k<len; ++k, rest /= 3)
+                {
+                    string[k] = (char) ('a' + rest % 3);
+                }
+                string[len] = '\0';
+
+                bool expected, result;
+                assert(nfa_accepts(&expected_nfa, string, &expected) == OK);
+                assert(nfa_accepts(&nfa, string, &result) == OK);
+                assert(result == expected);
+            }
+        }
+
+        nfa_destroy(&expected_nfa);
+        nfa_destroy(&nfa);
+    }
+}
+
+void test_nfa_build_glushkov_long()
+{
+    // deeper than any recursive traversal could go
+    static char regexpr[1 << 17];
+    static char string[1 << 17];
+    size_t len = sizeof(regexpr) - 1, i;
+
+    // a long concatenation of characters
+    for (i=0; i<len; ++i)
+    {
+        regexpr[i] = (char) ('a' + i % 26);
+    }
+    regexpr[len] = '\0';
+
+    node_t* tree;
+    nfa_t nfa;
+    bool result;
+    assert(tree_parse(&tree, regexpr) == OK);
+    assert(tree_optimize(&tree) == OK);
+    assert(nfa_build_glushkov(&nfa, tree) == OK);
+    tree_deinit(&tree);
+
+    assert(nfa_accepts(&nfa, regexpr, &result) == OK);
+    assert(result);
+    memcpy(string, regexpr, len - 1);
+    string[len - 1] = '\0';
+    assert(nfa_accepts(&nfa, string, &result) == OK);
+    assert(!result);
+    nfa_destroy(&nfa);
+
+    // a long union of starred sequences: (ab*)+(ab*)+...
+    for (i=0; i+6<=len; i+=6)
+    {
+        memcpy(regexpr + i, "(ab*)+", 6);
+    }
+    regexpr[i - 1] = '\0';
+
+    assert(tree_parse(&tree, regexpr) == OK);
+    assert(tree_optimize(&tree) == OK);
+    assert(nfa_build_glushkov(&nfa, tree) == OK);
+    tree_deinit(&tree);
+
+    assert(nfa_accepts(&nfa, "abbb", &result) == OK);
+    assert(result);
+    assert(nfa_accepts(&nfa, "abab", &result) == OK);
+    assert(!result);
+    nfa_destroy(&nfa);
+}
+
+void test_nfa_trim()
+{
+    // 0 -a-> 1 (final), 0 -b-> 2 -b-> 2 (never accepts), 3 (final, never entered)
+    int table[4 * ASCII_LEN];
+    bool final[4] = {false, true, false, true};
+    memset(table, -1, sizeof(table));
+    table[0 * ASCII_LEN + 'a'] = 1;
+    table[0 * ASCII_LEN + 'b'] = 2;
+    table[2 * ASCII_LEN + 'b'] = 2;
+    table[3 * ASCII_LEN + 'a'] = 1;
+
+    dfa_t dfa = {.states_len = 4, .classes_len = ASCII_LEN, .class_map = NULL, .table = table, .final = final, .tags = NULL};
+    nfa_t nfa;
+    assert(dfa_to_nfa(&nfa, &dfa) == OK);
+
+    // the match stops on the dead state
+    assert(nfa_compact(&nfa) == OK);
+    assert(nfa.states[2].dead);
+    assert(!nfa.states[0].dead && !nfa.states[3].dead);
+
+    match_t match;
+    assert(match_begin(&match, &nfa) == OK);
+    match_feed(&match, 'b');
+    assert(match_is_dead(&match));
+    match_end(&match);
+
+    assert(nfa_trim(&nfa) == OK);
+    assert(nfa.states_len == 2);
+    assert(nfa.states[0].len == 1);
+
+    static const char* strings[] = {"", "a", "b", "bb", "aa"};
+    static const bool expected[] = {false, true, false, false, false};
+    size_t i;
+    for (i=0; i<sizeof(strings) / sizeof(strings[0]); ++i)
+    {
+        bool result;
+        assert(nfa_accepts(&nfa, strings[i], &result) == OK);
+        assert(result == expected[i]);
+    }
+
+    nfa_destroy(&nfa);
+
+    // the collection has nothing to trim
+    for (i=0; i<4; ++i)
+    {
+        size_t states_len = nfa_collection[i].states_len;
+        assert(nfa_trim(&nfa_collection[i]) == OK);
+        assert(nfa_collection[i].states_len == states_len);
+    }
+}
+
+void test_nfa_reduce()
+{
+    static const char* regexes[] = {"a+a", "(ab+a)*(b+ba)*", "((a+b)*a)(a+b)(a+b)", "((a*)*b)*", "a+(b*c)*", "ab+cb+abc+cbc"};
+
+    size_t i;
+    for (i=0; i<sizeof(regexes) / sizeof(regexes[0]); ++i)
+    {
+        node_t* tree;
+        nfa_t expected_nfa, nfa;
+        assert(tree_parse(&tree, regexes[i]) == OK);
+        assert(nfa_build(&expected_nfa, tree) == OK);
+        assert(nfa_build(&nfa, tree) == OK);
+        tree_deinit(&tree);
+
+        assert(nfa_reduce(&nfa) == OK);
+        assert(nfa.states_len <= expected_nfa.states_len);
+        nfa_compare(&nfa, &expected_nfa);
+
+        // every string of length < 7 over {a, b, c}
+        char string[7];
+        size_t len, code, count;
+        for (len=0, count=1; len<sizeof(string); ++len, count *= 3)
+        {
+            for (code=0; code<count; ++code)
+            {
+                size_t k, rest = code;
+                for (k=0; k<len; ++k, rest /= 3)
+                {
+                    string[k] = (char) ('a' + rest % 3);
+                }
+                string[len] = '\0';
+
+                bool expected, result;
+                assert(nfa_accepts(&expected_nfa, string, &expected) == OK);
+                assert(nfa_accepts(&nfa, string, &result) == OK);
+                assert(result == expected);
+            }
+        }
+
+        // the two targets of a merge into one, without the repeated transition
+        if (i == 0)
+        {
+            assert(nfa.states_len == 2);
+            assert(nfa.states[0].len == 1);
+        }
+
+        nfa_destroy(&expected_nfa);
+        nfa_destroy(&nfa);
+    }
+}
+
+void test_nfa_layout()
+{
+    static const char* regexes[] = {"(ab+a)*(b+ba)*", "((a+b)*a)(a+b)(a+b)", "a+(b*c)*", "ab+cb+abc+cbc"};
+    static const char* corpus[] = {"abba", "aaaaab", "bcbcbc", "cccc", "abcbc", "ba", "", "abab"};
+    const size_t corpus_len = sizeof(corpus) / sizeof(corpus[0]);
+
+    size_t i;
+    for (i=0; i<sizeof(regexes) / sizeof(regexes[0]); ++i)
+    {
+        node_t* tree;
+        nfa_t expected_nfa, nfa;
+        assert(tree_parse(&tree, regexes[i]) == OK);
+        assert(nfa_build(&expected_nfa, tree) == OK);
+        assert(nfa_build(&nfa, tree) == OK);
+        tree_deinit(&tree);
+
+        // breadth-first: every state but the initial one is entered from a state before it
+        assert(nfa_layout(&nfa, NULL) == OK);
+        assert(nfa.states_len == expected_nfa.states_len);
+
+        size_t s, t, j;
+        for (t=1; t<nfa.states_len; ++t)
+        {
+            bool entered = false;
+            for (s=0; s<t && !entered; ++s)
+            {
+                for (j=0; j<nfa.states[s].len; ++j)
+                {
+                    entered |= (nfa.states[s].mapped_state[j] == (int) t);
+                }
+            }
+            assert(entered);
+        }
+
+        // by visits: the states most active on the corpus come first
+        size_t visits[nfa.states_len];
+        memset(visits, 0, sizeof(visits));
+        assert(nfa_profile(&nfa, corpus, corpus_len, visits) == OK);
+        assert(visits[0] >= corpus_len);
+        assert(nfa_layout(&nfa, visits) == OK);
+
+        memset(visits, 0, sizeof(visits));
+        assert(nfa_profile(&nfa, corpus, corpus_len, visits) == OK);
+        for (s=2; s<nfa.states_len; ++s)
+        {
+            assert(visits[s - 1] >= visits[s]);
+        }
+
+        // the same language, also once compacted
+        size_t k;
+        for (k=0; k<2; ++k)
+        {
+            size_t m;
+            for (m=0; m<corpus_len; ++m)
+            {
+                bool expected, result;
+                assert(nfa_accepts(&expected_nfa, corpus[m], &expected) == OK);
+                assert(nfa_accepts(&nfa, corpus[m], &result) == OK);
+                assert(result == expected);
+            }
+
+            assert(nfa_compact(&nfa) == OK);
+        }
+
+        nfa_destroy(&expected_nfa);
+        nfa_destroy(&nfa);
+    }
+}
+
 void test_nfa_destroy()
 {
     int i;
@@ -141,6 +681,119 @@ void test_nfa_load()
     nfa_collection_delete(loaded_nfa, l_nfa_size);
 }
 
+void test_nfa_save()
+{
+    const char* strings[] = {"0", "1234", "abc", "a1", ":", "\"g", "'x'", "", "#"};
+
+    assert(nfa_collection_save(nfa_collection, 4, "test2_collection.dat") == OK);
+
+    nfa_t* loaded_nfa;
+    size_t l_nfa_size;
+    assert(nfa_collection_load(&loaded_nfa, &l_nfa_size, "test2_collection.dat") == OK);
+    assert(l_nfa_size == 4);
+    assert(loaded_nfa[0].mapping != NULL);
+
+    size_t i;
+    for (i=0; i<l_nfa_size; ++i)
+    {
+        assert(loaded_nfa[i].states_len == nfa_collection[i].states_len);
+
+        // used in place from the mapping
+        size_t j;
+        for (j=0; j<loaded_nfa[i].states_len; ++j)
+        {
+            assert(loaded_nfa[i].states[j].capacity == 0);
+            assert(loaded_nfa[i].states[j].len == nfa_collection[i].states[j].len);
+        }
+
+        for (j=0; j<sizeof(strings) / sizeof(strings[0]); ++j)
+        {
+            bool expected = false, accepted = false;
+            assert(nfa_accepts(&nfa_collection[i], strings[j], &expected) == OK);
+            assert(nfa_accepts(&loaded_nfa[i], strings[j], &accepted) == OK);
+            assert(accepted == expected);
+        }
+    }
+
+    nfa_t merged;
+    assert(nfa_collection_load_merged(&merged, "test2_collection.dat") == OK);
+    assert(merged.tags != NULL);
+
+    // the same automata, mapped once
+    nfa_t* opened_nfa;
+    nfa_t opened_merged;
+    size_t opened_size, classes_len;
+    unsigned char class_map[ASCII_LEN];
+    assert(nfa_collection_open(&opened_nfa, &opened_size, &opened_merged, class_map, &classes_len, "test2_collection.dat") == OK);
+    assert(opened_size == l_nfa_size);
+    assert(opened_nfa[0].mapping != NULL);
+    assert(opened_merged.mapping == NULL);
+    assert(opened_merged.states_len == merged.states_len);
+    assert(memcmp(opened_merged.tags, merged.tags, sizeof(int) * merged.states_len) == 0);
+    assert(classes_len > 0);
+
+    size_t j;
+    for (j=0; j<sizeof(strings) / sizeof(strings[0]); ++j)
+    {
+        bool expected = false, accepted = false;
+        assert(nfa_accepts(&merged, strings[j], &expected) == OK);
+        assert(nfa_accepts(&opened_merged, strings[j], &accepted) == OK);
+        assert(accepted == expected);
+    }
+
+    nfa_destroy(&opened_merged);
+    nfa_collection_delete(opened_nfa, opened_size);
+    nfa_destroy(&merged);
+
+    nfa_collection_delete(loaded_nfa, l_nfa_size);
+
+    // a corrupted file fails the checksum
+    FILE* file = fopen("test2_collection.dat", "r+b");
+    assert(file != NULL);
+    assert(fseek(file, -1, SEEK_END) == 0);
+    int c = fgetc(file);
+    assert(fseek(file, -1, SEEK_END) == 0);
+    fputc(c ^ 1, file);
+    fclose(file);
+
+    assert(nfa_collection_load(&loaded_nfa, &l_nfa_size, "test2_collection.dat") == INVALID_FORMAT);
+    remove("test2_collection.dat");
+}
+
+void test_nfa_cache()
+{
+    const char* strings[] = {"0", "1234", "abc", "a1", ":", ""};
+
+    uint64_t key = nfa_cache_key("[0-9]+", 0);
+    assert(key == nfa_cache_key("[0-9]+", 0));
+    assert(key != nfa_cache_key("[0-9]*", 0));
+    assert(key != nfa_cache_key("[0-9]+", 1));
+
+    // nothing cached yet
+    nfa_t loaded;
+    assert(nfa_cache_load(&loaded, "test2_cache", key) == IO_ERROR);
+
+    assert(nfa_cache_store(&nfa_collection[0], "test2_cache", key) == OK);
+    assert(nfa_cache_load(&loaded, "test2_cache", key) == OK);
+    assert(loaded.mapping != NULL);
+    assert(loaded.states_len == nfa_collection[0].states_len);
+
+    size_t i;
+    for (i=0; i<sizeof(strings) / sizeof(strings[0]); ++i)
+    {
+        bool expected = false, accepted = false;
+        assert(nfa_accepts(&nfa_collection[0], strings[i], &expected) == OK);
+        assert(nfa_accepts(&loaded, strings[i], &accepted) == OK);
+        assert(accepted == expected);
+    }
+    nfa_destroy(&loaded);
+
+    char path[64];
+    snprintf(path, sizeof(path), "test2_cache/%016" PRIx64 ".dat", key);
+    assert(remove(path) == 0);
+    assert(rmdir("test2_cache") == 0);
+}
+
 int main()
 {
     printf("[*] Setting up...\n");
@@ -155,6 +808,58 @@ int main()
     printf("[+] Test Successful\n");
 
 
+    printf("[*] Test nfa_accepts on long strings:\n");
+    test_nfa_accepts_long();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test match:\n");
+    test_match();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test nfa_accepts_batch:\n");
+    test_nfa_accepts_batch();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test match_accepts from several threads:\n");
+    test_match_shared();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test nfa_compact:\n");
+    test_nfa_compact();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test nfa_build on character classes:\n");
+    test_nfa_set();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test nfa_build_glushkov:\n");
+    test_nfa_build_glushkov();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test nfa_build_glushkov on long expressions:\n");
+    test_nfa_build_glushkov_long();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test nfa_trim\n");
+    test_nfa_trim();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test nfa_reduce\n");
+    test_nfa_reduce();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test nfa_layout\n");
+    test_nfa_layout();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test nfa_collection_save\n");
+    test_nfa_save();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test nfa_cache\n");
+    test_nfa_cache();
+    printf("[+] Test Successful\n");
+
     printf("[*] Test nfa_collection_load\n");
     test_nfa_load();
     printf("[*] Test Successful\n");
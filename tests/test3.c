@@ -3,6 +3,9 @@
 #include <compiler_errors.h>
 #include <lexer.h>
 #include <assert.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 /* Testing lexer functionalities */
 
@@ -20,6 +23,10 @@ void test_tokenizer_init(void)
 
     assert(token_list.nfa_collection != NULL);
     assert(token_list.nfa_collection_size > 0);
+
+    // collections saved by build_collection carry the merged automaton
+    assert(token_list.merged_dfa != NULL);
+    assert(token_list.merged_dfa->tags != NULL);
 }
 
 void test_tokenizer_deinit(void)
@@ -31,6 +38,7 @@ void test_tokenizer_deinit(void)
     assert(token_list.list_size == 0);
     assert(token_list.nfa_collection == NULL);
     assert(token_list.nfa_collection_size == 0);
+    assert(token_list.merged_dfa == NULL);
 }
 
 void test_tokenize(void)
@@ -44,6 +52,279 @@ void test_tokenize(void)
     print_tokens(&token_list);
 }
 
+// The tables compiled in the library tokenize as the collection file does
+void test_tokenizer_init_builtin(void)
+{
+    toklist_t builtin_list;
+    bzero(&builtin_list, sizeof(toklist_t));
+    char string[sizeof(string_to_tokenize)];
+    memcpy(string, string_to_tokenize, sizeof(string));
+
+    assert(tokenizer_init_builtin(&builtin_list) == OK);
+    assert(builtin_list.builtin);
+    assert(builtin_list.merged_dfa != NULL);
+    assert(builtin_list.scan != NULL);
+    assert(builtin_list.nfa_collection == NULL);
+
+    assert(tokenize(&builtin_list, string) == OK);
+    assert(builtin_list.list_size == token_list.list_size);
+
+    size_t i;
+    for (i=0; i<token_list.list_size; ++i)
+    {
+        assert(builtin_list.list[i].tt == token_list.list[i].tt);
+        assert(strcmp(builtin_list.list[i].tk, token_list.list[i].tk) == 0);
+    }
+
+    tokenizer_deinit(&builtin_list);
+    assert(builtin_list.merged_dfa == NULL);
+}
+
+// The longest token is taken at every position, the last one included, on every matching path
+void test_tokenize_maximal_munch(void)
+{
+    toklist_t list;
+    assert(tokenizer_init_builtin(&list) == OK);
+
+    // the last token is kept
+    assert(tokenize(&list, "x := 10") == OK);
+    assert(list.list_size == 5);
+    assert(list.list[4].tt == NUMBER);
+    assert(strcmp(list.list[4].tk, "10") == 0);
+
+    // more tokens than the initial capacity, tokenizing again drops the previous ones
+    char many[3 * ASCII_LEN * 4 + 1];
+    size_t i;
+    for (i=0; i<3 * ASCII_LEN; ++i)
+    {
+        memcpy(&many[4 * i], "ab, ", 4);
+    }
+    many[sizeof(many) - 1] = '\0';
+
+    assert(tokenize(&list, many) == OK);
+    assert(list.list_size == 3 * 3 * ASCII_LEN);
+    assert(list.list_capacity >= list.list_size);
+    for (i=0; i<list.list_size; i += 3)
+    {
+        assert(list.list[i].tt == NAME && strcmp(list.list[i].tk, "ab") == 0);
+        assert(list.list[i + 1].tt == ARGSTOP);
+        assert(list.list[i + 2].tt == DELIM);
+    }
+
+    // characters matching no token
+    assert(tokenize(&list, "x := #") == INVALID_TOKEN);
+    assert(list.list == NULL);
+    assert(list.merged_dfa == NULL);
+
+    // every token has the type of the first DFA of the collection accepting it
+    for (i=0; i<token_list.list_size; ++i)
+    {
+        size_t j;
+        bool accepted = false;
+        for (j=0; j<token_list.nfa_collection_size && !accepted; ++j)
+        {
+            dfa_t dfa;
+            assert(dfa_from_nfa(&dfa, &token_list.nfa_collection[j]) == OK);
+            assert(dfa_accepts(&dfa, token_list.list[i].tk, &accepted) == OK);
+            dfa_destroy(&dfa);
+        }
+
+        assert(accepted);
+        assert(token_list.list[i].tt == (toktype_t) (j - 1));
+    }
+}
+
+// Input served a few characters at a time, so that tokens straddle the chunks
+typedef struct _pieces{
+    const char* string;
+    size_t len;
+    size_t read;
+    size_t piece_len;
+} pieces_t;
+
+static ssize_t read_pieces(void* source, char* buffer, size_t len)
+{
+    pieces_t* pieces = source;
+
+    size_t n = pieces->len - pieces->read;
+    n = (n < pieces->piece_len) ? n : pieces->piece_len;
+    n = (n < len) ? n : len;
+
+    memcpy(buffer, pieces->string + pieces->read, n);
+    pieces->read += n;
+    return (ssize_t) n;
+}
+
+static int count_tokens(void* context, toktype_t tt, const char* tk, size_t len)
+{
+    (void) tt;
+    (void) tk;
+    (void) len;
+
+    ++*(size_t*) context;
+    return OK;
+}
+
+static int stop_after_three(void* context, toktype_t tt, const char* tk, size_t len)
+{
+    count_tokens(context, tt, tk, len);
+    return (*(size_t*) context == 3) ? INVALID_TOKEN : OK;
+}
+
+// Appends the token to the list of the context
+static int collect(void* context, toktype_t tt, const char* tk, size_t len)
+{
+    toklist_t* list = context;
+    assert(list->list_size < list->list_capacity);
+
+    list->list[list->list_size].tt = tt;
+    list->list[list->list_size].tk = strndup(tk, len);
+    assert(list->list[list->list_size].tk != NULL);
+    ++list->list_size;
+    return OK;
+}
+
+void test_tokenize_stream(void)
+{
+    // every size of the pieces gives the tokens of tokenize
+    size_t piece_len;
+    for (piece_len=1; piece_len<=sizeof(string_to_tokenize); piece_len += 3)
+    {
+        pieces_t pieces = {string_to_tokenize, strlen(string_to_tokenize), 0, piece_len};
+
+        toklist_t list = {0};
+        token_t tokens[token_list.list_size];
+        list.list = tokens;
+        list.list_capacity = token_list.list_size;
+
+        assert(tokenize_stream(&token_list, read_pieces, &pieces, collect, &list) == OK);
+        assert(list.list_size == token_list.list_size);
+
+        size_t i;
+        for (i=0; i<list.list_size; ++i)
+        {
+            assert(list.list[i].tt == token_list.list[i].tt);
+            assert(strcmp(list.list[i].tk, token_list.list[i].tk) == 0);
+            free(list.list[i].tk);
+        }
+    }
+
+    // the consumer stops the tokenizer
+    pieces_t pieces = {string_to_tokenize, strlen(string_to_tokenize), 0, 7};
+    size_t consumed = 0;
+    assert(tokenize_stream(&token_list, read_pieces, &pieces, stop_after_three, &consumed) == INVALID_TOKEN);
+    assert(consumed == 3);
+
+    // a file with a token longer than a chunk, read through a descriptor
+    FILE* file = fopen("test3_stream.tc", "w");
+    assert(file != NULL);
+    size_t i;
+    for (i=0; i<3 * TOKENIZER_CHUNK_LEN; ++i)
+    {
+        fputc('n', file);
+    }
+    fputs(" := \"a string\"\n", file);
+    fclose(file);
+
+    int fd = open("test3_stream.tc", O_RDONLY);
+    assert(fd != -1);
+
+    toklist_t list;
+    assert(tokenizer_init_shared(&list, &token_list) == OK);
+    assert(tokenize_fd(&list, fd) == OK);
+    close(fd);
+    remove("test3_stream.tc");
+
+    assert(list.list_size == 6);
+    assert(list.list[0].tt == NAME && strlen(list.list[0].tk) == 3 * TOKENIZER_CHUNK_LEN);
+    assert(list.list[2].tt == DEFINE_OP);
+    assert(list.list[4].tt == STRING && strcmp(list.list[4].tk, "\"a string\"") == 0);
+    assert(list.list[5].tt == DELIM);
+    tokenizer_deinit(&list);
+
+    // an open string at the end of the input, after the 4 tokens before it
+    pieces_t open_string = {"x := \"open", 10, 0, 4};
+    consumed = 0;
+    assert(tokenize_stream(&token_list, read_pieces, &open_string, count_tokens, &consumed) == INVALID_TOKEN);
+    assert(consumed == 4);
+
+    // ONE CHARACTER PER READ: the scan of a long token resumes at every character
+    size_t long_len = TOKENIZER_MAX_TOKEN_LEN / 2;
+    char* long_input = malloc(TOKENIZER_MAX_TOKEN_LEN + 16);
+    assert(long_input != NULL);
+    memset(long_input, 'n', long_len);
+    memcpy(long_input + long_len, " := 1", 5);
+
+    pieces_t long_name = {long_input, long_len + 5, 0, 1};
+    consumed = 0;
+    assert(tokenize_stream(&token_list, read_pieces, &long_name, count_tokens, &consumed) == OK);
+    assert(consumed == 5);
+
+    // a stray quote matches the trash token as long as no quote closes it: past the longest token it fails
+    memcpy(long_input, "x := \"", 6);
+    memset(long_input + 6, 'n', TOKENIZER_MAX_TOKEN_LEN + 8);
+
+    pieces_t stray_quote = {long_input, TOKENIZER_MAX_TOKEN_LEN + 14, 0, 1};
+    consumed = 0;
+    assert(tokenize_stream(&token_list, read_pieces, &stray_quote, count_tokens, &consumed) == INVALID_TOKEN);
+    assert(consumed == 4);
+    assert(stray_quote.read < stray_quote.len);
+
+    free(long_input);
+}
+
+#define SHARED_THREADS 4
+
+// Tokenizes the string with a tokenizer of its own on the automata of token_list
+static void* tokenize_shared(void* arg)
+{
+    (void) arg;
+
+    toklist_t shared_list;
+    char string[sizeof(string_to_tokenize)];
+
+    size_t k;
+    for (k=0; k<64; ++k)
+    {
+        memcpy(string, string_to_tokenize, sizeof(string));
+        assert(tokenizer_init_shared(&shared_list, &token_list) == OK);
+        assert(tokenize(&shared_list, string) == OK);
+        assert(shared_list.list_size == token_list.list_size);
+
+        size_t i;
+        for (i=0; i<token_list.list_size; ++i)
+        {
+            assert(shared_list.list[i].tt == token_list.list[i].tt);
+            assert(strcmp(shared_list.list[i].tk, token_list.list[i].tk) == 0);
+        }
+
+        tokenizer_deinit(&shared_list);
+    }
+
+    return NULL;
+}
+
+// Several threads tokenize at once on the same loaded collection
+void test_tokenizer_init_shared(void)
+{
+    pthread_t threads[SHARED_THREADS];
+
+    size_t i;
+    for (i=0; i<SHARED_THREADS; ++i)
+    {
+        assert(pthread_create(&threads[i], NULL, tokenize_shared, NULL) == 0);
+    }
+
+    for (i=0; i<SHARED_THREADS; ++i)
+    {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+
+    // the automata are still there
+    assert(token_list.merged_dfa != NULL);
+    assert(token_list.nfa_collection != NULL);
+}
+
 int main()
 {
 
@@ -55,6 +336,22 @@ int main()
     test_tokenize();
     printf("[+] Test Successful\n");
 
+    printf("[*] Test tokenizer_init_builtin():\n");
+    test_tokenizer_init_builtin();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test tokenize() maximal munch:\n");
+    test_tokenize_maximal_munch();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test tokenize_stream():\n");
+    test_tokenize_stream();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test tokenizer_init_shared():\n");
+    test_tokenizer_init_shared();
+    printf("[+] Test Successful\n");
+
     printf("[*] Test tokenizer_deinit():\n");
     test_tokenizer_deinit();
     printf("[+] Test Successful\n");
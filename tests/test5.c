@@ -0,0 +1,700 @@
+#include <nfa_builder.h>
+#include <dfa_builder.h>
+#include <regexparse.h>
+#include <compiler_errors.h>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Testing DFA functionalities */
+
+#define REGEXBUFFER_LEN (sizeof(regex_buffer) / sizeof(regex_buffer[0]))
+
+static const char* regex_buffer[] = {
+				"\n+\t+ ",
+				":=",
+				"(0+1+2+3+4+5+6+7+8+9)(0+1+2+3+4+5+6+7+8+9)*",
+				"(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+$+_)(a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_)*",
+				"\"((a+b+c+d+e+f+g+h+i+j+k+l+m+n+o+p+q+r+s+t+u+v+w+x+y+z+A+B+C+E+F+G+H+I+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z+0+1+2+3+4+5+6+7+8+9+$+_+\\\\+/+ +<+>+&+\\++-+#+\\[+\\]+=+:+?+^+,+.+;+\\*)*)\"",
+				"(ab+a)*(b+ba)*",
+				"((a+b)*a)(a+b)(a+b)"
+};
+
+static const char* strings[] = {
+				"", " ", "\n", ":", ":=", ":==", "0", "0123", "12a",
+				"name", "_$name$_", "00name", "\"", "\"str\"", "\"a string\"", "\"open",
+				"a", "b", "ab", "ba", "aab", "abba", "abab", "aaaa", "bbbb", "babab", "abbb"
+};
+
+static nfa_t nfa_collection[REGEXBUFFER_LEN];
+static dfa_t dfa_collection[REGEXBUFFER_LEN];
+
+void setup()
+{
+    size_t i;
+    for (i=0; i<REGEXBUFFER_LEN; ++i)
+    {
+        node_t* tree;
+        assert(tree_parse(&tree, regex_buffer[i]) == OK);
+        assert(nfa_build(&nfa_collection[i], tree) == OK);
+        tree_deinit(&tree);
+    }
+}
+
+void teardown()
+{
+    size_t i;
+    for (i=0; i<REGEXBUFFER_LEN; ++i)
+    {
+        nfa_destroy(&nfa_collection[i]);
+    }
+}
+
+void test_dfa_from_nfa()
+{
+    size_t i;
+    for (i=0; i<REGEXBUFFER_LEN; ++i)
+    {
+        assert(dfa_from_nfa(&dfa_collection[i], &nfa_collection[i]) == OK);
+        assert(dfa_collection[i].states_len > 0);
+        assert(dfa_collection[i].table != NULL);
+        assert(dfa_collection[i].final != NULL);
+
+        size_t j;
+        for (j=0; j<dfa_collection[i].states_len * ASCII_LEN; ++j)
+        {
+            assert(dfa_collection[i].table[j] >= DFA_DEAD_STATE);
+            assert(dfa_collection[i].table[j] < (int) dfa_collection[i].states_len);
+        }
+    }
+}
+
+void test_dfa_accepts()
+{
+    size_t i;
+    for (i=0; i<REGEXBUFFER_LEN; ++i)
+    {
+        size_t j;
+        for (j=0; j<sizeof(strings) / sizeof(strings[0]); ++j)
+        {
+            bool nfa_result = false;
+            bool dfa_result = true;
+
+            assert(nfa_accepts(&nfa_collection[i], strings[j], &nfa_result) == OK);
+            assert(dfa_accepts(&dfa_collection[i], strings[j], &dfa_result) == OK);
+            assert(nfa_result == dfa_result);
+        }
+    }
+
+    // every string of length < 8 over {a, b} against the last two regexes
+    char string[8];
+    unsigned int bits, len;
+    for (len=0; len<8; ++len)
+    {
+        for (bits=0; bits < (1u << len); ++bits)
+        {
+            unsigned int k;
+            for (k=0; k<len; ++k)
+            {
+                string[k] = (bits & (1u << k)) ? 'b' : 'a';
+            }
+            string[len] = '\0';
+
+            for (i=REGEXBUFFER_LEN-2; i<REGEXBUFFER_LEN; ++i)
+            {
+                bool nfa_result = false;
+                bool dfa_result = true;
+
+                assert(nfa_accepts(&nfa_collection[i], string, &nfa_result) == OK);
+                assert(dfa_accepts(&dfa_collection[i], string, &dfa_result) == OK);
+                assert(nfa_result == dfa_result);
+            }
+        }
+    }
+}
+
+void test_dfa_minimize()
+{
+    size_t i;
+    for (i=0; i<REGEXBUFFER_LEN; ++i)
+    {
+        dfa_t minimal;
+        assert(dfa_from_nfa(&minimal, &nfa_collection[i]) == OK);
+        assert(dfa_minimize(&minimal) == OK);
+        assert(minimal.states_len > 0);
+        assert(minimal.states_len <= dfa_collection[i].states_len);
+
+        nfa_t nfa;
+        assert(dfa_to_nfa(&nfa, &minimal) == OK);
+        assert(nfa.states_len == minimal.states_len);
+
+        size_t j;
+        for (j=0; j<sizeof(strings) / sizeof(strings[0]); ++j)
+        {
+            bool dfa_result = false;
+            bool minimal_result = true;
+            bool nfa_result = true;
+
+            assert(dfa_accepts(&dfa_collection[i], strings[j], &dfa_result) == OK);
+            assert(dfa_accepts(&minimal, strings[j], &minimal_result) == OK);
+            assert(nfa_accepts(&nfa, strings[j], &nfa_result) == OK);
+            assert(dfa_result == minimal_result);
+            assert(dfa_result == nfa_result);
+        }
+
+        nfa_destroy(&nfa);
+
+        // minimizing a minimal DFA changes nothing
+        size_t states_len = minimal.states_len;
+        assert(dfa_minimize(&minimal) == OK);
+        assert(minimal.states_len == states_len);
+
+        dfa_destroy(&minimal);
+    }
+
+    // known minimal sizes: whitespace, numbers, third to last symbol is an 'a'
+    static const size_t expected[][2] = {{0, 2}, {2, 2}, {REGEXBUFFER_LEN-1, 8}};
+    for (i=0; i<sizeof(expected) / sizeof(expected[0]); ++i)
+    {
+        dfa_t minimal;
+        assert(dfa_from_nfa(&minimal, &nfa_collection[expected[i][0]]) == OK);
+        assert(dfa_minimize(&minimal) == OK);
+        assert(minimal.states_len == expected[i][1]);
+        dfa_destroy(&minimal);
+    }
+}
+
+void test_dfa_compress()
+{
+    unsigned char class_map[ASCII_LEN];
+    size_t classes_len;
+
+    assert(nfa_collection_classes(nfa_collection, REGEXBUFFER_LEN, class_map, &classes_len) == OK);
+    assert(classes_len > 1 && classes_len < ASCII_LEN);
+
+    size_t c;
+    for (c=0; c<ASCII_LEN; ++c)
+    {
+        assert(class_map[c] < classes_len);
+    }
+
+    // on the minimized collection letters other than 'a' and 'b' are all alike, digits too
+    nfa_t minimal_collection[REGEXBUFFER_LEN];
+    unsigned char minimal_class_map[ASCII_LEN];
+    size_t minimal_classes_len;
+
+    size_t i;
+    for (i=0; i<REGEXBUFFER_LEN; ++i)
+    {
+        dfa_t minimal;
+        assert(dfa_from_nfa(&minimal, &nfa_collection[i]) == OK);
+        assert(dfa_minimize(&minimal) == OK);
+        assert(dfa_to_nfa(&minimal_collection[i], &minimal) == OK);
+        dfa_destroy(&minimal);
+    }
+
+    assert(nfa_collection_classes(minimal_collection, REGEXBUFFER_LEN, minimal_class_map, &minimal_classes_len) == OK);
+    assert(minimal_classes_len <= classes_len);
+    assert(minimal_class_map['c'] == minimal_class_map['z']);
+    assert(minimal_class_map['0'] == minimal_class_map['9']);
+    assert(minimal_class_map['a'] != minimal_class_map['c']);
+    assert(minimal_class_map['a'] != minimal_class_map['b']);
+    assert(minimal_class_map['0'] != minimal_class_map['c']);
+
+    for (i=0; i<REGEXBUFFER_LEN; ++i)
+    {
+        nfa_destroy(&minimal_collection[i]);
+    }
+
+    for (i=0; i<REGEXBUFFER_LEN; ++i)
+    {
+        dfa_t compressed;
+        assert(dfa_from_nfa(&compressed, &nfa_collection[i]) == OK);
+        assert(dfa_compress(&compressed, class_map, classes_len) == OK);
+        assert(compressed.classes_len == classes_len);
+        assert(compressed.states_len == dfa_collection[i].states_len);
+
+        size_t j;
+        for (j=0; j<sizeof(strings) / sizeof(strings[0]); ++j)
+        {
+            bool dfa_result = false;
+            bool compressed_result = true;
+
+            assert(dfa_accepts(&dfa_collection[i], strings[j], &dfa_result) == OK);
+            assert(dfa_accepts(&compressed, strings[j], &compressed_result) == OK);
+            assert(dfa_result == compressed_result);
+        }
+
+        // minimization works on classes as well
+        dfa_t minimal;
+        assert(dfa_from_nfa(&minimal, &nfa_collection[i]) == OK);
+        assert(dfa_minimize(&minimal) == OK);
+        assert(dfa_minimize(&compressed) == OK);
+        assert(compressed.states_len == minimal.states_len);
+
+        dfa_destroy(&minimal);
+        dfa_destroy(&compressed);
+    }
+}
+
+void test_dfa_classify()
+{
+    nfa_t merged;
+    assert(nfa_collection_merge(&merged, nfa_collection, REGEXBUFFER_LEN) == OK);
+    assert(merged.tags != NULL);
+
+    dfa_t dfa;
+    assert(dfa_from_nfa(&dfa, &merged) == OK);
+    assert(dfa.tags != NULL);
+
+    dfa_t minimal;
+    assert(dfa_from_nfa(&minimal, &merged) == OK);
+    assert(dfa_minimize(&minimal) == OK);
+    assert(minimal.states_len <= dfa.states_len);
+
+    // the tag is the index of the first regex accepting the string
+    size_t j;
+    for (j=0; j<sizeof(strings) / sizeof(strings[0]); ++j)
+    {
+        int expected = NFA_NO_TAG;
+        size_t i;
+        for (i=0; i<REGEXBUFFER_LEN && expected == NFA_NO_TAG; ++i)
+        {
+            bool result;
+            assert(nfa_accepts(&nfa_collection[i], strings[j], &result) == OK);
+            expected = result ? (int) i : NFA_NO_TAG;
+        }
+
+        bool accepted;
+        int tag;
+        assert(nfa_accepts(&merged, strings[j], &accepted) == OK);
+        assert(accepted == (expected != NFA_NO_TAG));
+        assert(dfa_classify(&dfa, strings[j], &tag) == OK);
+        assert(tag == expected);
+        assert(dfa_classify(&minimal, strings[j], &tag) == OK);
+        assert(tag == expected);
+    }
+
+    // untagged DFAs classify accepted strings as 0
+    int tag;
+    assert(dfa_classify(&dfa_collection[1], ":=", &tag) == OK);
+    assert(tag == 0);
+    assert(dfa_classify(&dfa_collection[1], ":", &tag) == OK);
+    assert(tag == NFA_NO_TAG);
+
+    dfa_destroy(&minimal);
+    dfa_destroy(&dfa);
+    nfa_destroy(&merged);
+    assert(merged.tags == NULL);
+}
+
+void test_dfa_classify_batch()
+{
+    nfa_t merged;
+    assert(nfa_collection_merge(&merged, nfa_collection, REGEXBUFFER_LEN) == OK);
+    dfa_t tagged;
+    assert(dfa_from_nfa(&tagged, &merged) == OK);
+
+    // the strings, one out of the ASCII range and a long one, then as many again to fill several batches
+    const size_t strings_len = sizeof(strings) / sizeof(strings[0]);
+    const char* batch[2 * (strings_len + 2)];
+    char long_name[256];
+    memset(long_name, 'n', sizeof(long_name) - 1);
+    long_name[sizeof(long_name) - 1] = '\0';
+
+    size_t len = 0;
+    size_t k;
+    for (k=0; k<2; ++k)
+    {
+        size_t j;
+        for (j=0; j<strings_len; ++j)
+        {
+            batch[len++] = strings[j];
+        }
+        batch[len++] = "na\xe9me";
+        batch[len++] = long_name;
+    }
+
+    size_t i;
+    for (i=0; i<=REGEXBUFFER_LEN; ++i)
+    {
+        const dfa_t* dfa = (i < REGEXBUFFER_LEN) ? &dfa_collection[i] : &tagged;
+
+        int tags[len];
+        assert(dfa_classify_batch(dfa, batch, len, tags) == OK);
+
+        size_t j;
+        for (j=0; j<len; ++j)
+        {
+            int expected;
+            assert(dfa_classify(dfa, batch[j], &expected) == OK);
+            assert(tags[j] == expected);
+        }
+    }
+
+    // an empty batch
+    assert(dfa_classify_batch(&tagged, NULL, 0, NULL) == OK);
+
+    dfa_destroy(&tagged);
+    nfa_destroy(&merged);
+}
+
+#define SEARCH_MAX_MATCHES 64
+
+typedef struct _search_result{
+    size_t len;
+    size_t start[SEARCH_MAX_MATCHES];
+    size_t end[SEARCH_MAX_MATCHES];
+    int tag[SEARCH_MAX_MATCHES];
+} search_result_t;
+
+static int search_collect(size_t start, size_t len, int tag, void* context)
+{
+    search_result_t* result = context;
+    if (result->len == SEARCH_MAX_MATCHES)
+    {
+        return INVALID_BUFFER;
+    }
+
+    result->start[result->len] = start;
+    result->end[result->len] = start + len;
+    result->tag[result->len] = tag;
+    ++result->len;
+    return OK;
+}
+
+// Tag of the len characters of string as dfa_classify, NUL characters included
+static int classify_len(const dfa_t* dfa, const char* string, size_t len)
+{
+    int state = 0;
+    size_t i;
+    for (i=0; i<len && state != DFA_DEAD_STATE; ++i)
+    {
+        unsigned char c = (unsigned char) string[i];
+        if (c >= ASCII_LEN)
+        {
+            return NFA_NO_TAG;
+        }
+
+        size_t column = (dfa->class_map != NULL) ? dfa->class_map[c] : c;
+        state = dfa->table[(size_t) state * dfa->classes_len + column];
+    }
+
+    if (state == DFA_DEAD_STATE || !dfa->final[state])
+    {
+        return NFA_NO_TAG;
+    }
+
+    return (dfa->tags != NULL) ? dfa->tags[state] : 0;
+}
+
+// Leftmost-longest matches found by classifying every substring
+static void search_naive(const dfa_t* dfa, const char* buffer, size_t len, search_result_t* result)
+{
+    result->len = 0;
+    size_t start = 0;
+    while (start <= len)
+    {
+        bool matched = false;
+        size_t end;
+        for (end=len+1; end-- > start && !matched;)
+        {
+            int tag = classify_len(dfa, buffer + start, end - start);
+            if (tag != NFA_NO_TAG)
+            {
+                matched = true;
+                assert(search_collect(start, end - start, tag, result) == OK);
+            }
+        }
+
+        if (!matched)
+        {
+            ++start;
+        }
+        else
+        {
+            start = (result->end[result->len-1] > start) ? result->end[result->len-1] : start + 1;
+        }
+    }
+}
+
+// Checks dfa_search against search_naive
+static void search_check(const dfa_t* dfa, const char* buffer, size_t len)
+{
+    search_result_t expected, found = {0};
+    search_naive(dfa, buffer, len, &expected);
+    assert(dfa_search(dfa, buffer, len, search_collect, &found) == OK);
+
+    assert(found.len == expected.len);
+    size_t k;
+    for (k=0; k<found.len; ++k)
+    {
+        assert(found.start[k] == expected.start[k]);
+        assert(found.end[k] == expected.end[k]);
+        assert(found.tag[k] == expected.tag[k]);
+    }
+}
+
+// Number of matches and end of the last one, for buffers with too many matches to keep
+typedef struct _search_count{
+    size_t len;
+    size_t start;
+    size_t end;
+} search_count_t;
+
+static int search_counter(size_t start, size_t len, int tag, void* context)
+{
+    (void) tag;
+    search_count_t* count = context;
+
+    // the matches come left to right, without overlapping
+    assert(count->len == 0 || start >= count->end);
+    ++count->len;
+    count->start = start;
+    count->end = start + len;
+    return OK;
+}
+
+// The DFA of a regular expression, through the NFA of nfa_build
+static void search_dfa(dfa_t* dfa, const char* regexpr)
+{
+    node_t* tree;
+    nfa_t nfa;
+    assert(tree_parse(&tree, regexpr) == OK);
+    assert(nfa_build(&nfa, tree) == OK);
+    assert(dfa_from_nfa(dfa, &nfa) == OK);
+    assert(dfa_minimize(dfa) == OK);
+    nfa_destroy(&nfa);
+    tree_deinit(&tree);
+}
+
+void test_dfa_search()
+{
+    const char* buffers[] = {
+        "", "x := 10; y := x + \"a string\"", "::=:=", "abba bab aab", "\"open \"closed\" 123abc",
+        "aaaabbbbabab", "\xe2\x82\xac := 1"
+    };
+    static const char with_nul[] = ":=\0:= 12\0\0\"a\0b\" x:=\0";
+
+    nfa_t merged;
+    assert(nfa_collection_merge(&merged, nfa_collection, REGEXBUFFER_LEN) == OK);
+    dfa_t tagged;
+    assert(dfa_from_nfa(&tagged, &merged) == OK);
+
+    size_t i;
+    for (i=0; i<=REGEXBUFFER_LEN; ++i)
+    {
+        const dfa_t* dfa = (i < REGEXBUFFER_LEN) ? &dfa_collection[i] : &tagged;
+
+        size_t j;
+        for (j=0; j<sizeof(buffers) / sizeof(buffers[0]); ++j)
+        {
+            search_check(dfa, buffers[j], strlen(buffers[j]));
+        }
+
+        // NUL characters are part of the buffer, the search goes on after them
+        search_check(dfa, with_nul, sizeof(with_nul) - 1);
+    }
+
+    // the literal prefix ":=" is found among its first character
+    search_result_t found = {0};
+    assert(dfa_search(&dfa_collection[1], "::=:=", 5, search_collect, &found) == OK);
+    assert(found.len == 2);
+    assert(found.start[0] == 1 && found.start[1] == 3);
+
+    found.len = 0;
+    assert(dfa_search(&dfa_collection[1], with_nul, sizeof(with_nul) - 1, search_collect, &found) == OK);
+    assert(found.len == 3);
+    assert(found.start[0] == 0 && found.start[1] == 3 && found.start[2] == 17);
+
+    // the callback stops the search
+    search_result_t full = {.len = SEARCH_MAX_MATCHES};
+    assert(dfa_search(&dfa_collection[2], "1 2", 3, search_collect, &full) == INVALID_BUFFER);
+
+    // every string of length < 9 over {a, b, \0}, on expressions whose matches wait for longer ones
+    static const char* regexes[] = {"a*b", "a+aa*b", "(ab)*", "(a(ba)*)+(ab)", "b+(a+b)*bb"};
+    static const char alphabet[] = {'a', 'b', '\0'};
+    for (i=0; i<sizeof(regexes) / sizeof(regexes[0]); ++i)
+    {
+        dfa_t dfa;
+        search_dfa(&dfa, regexes[i]);
+
+        char string[9];
+        size_t len, code, count;
+        for (len=0, count=1; len<sizeof(string); ++len, count *= 3)
+        {
+            for (code=0; code<count; ++code)
+            {
+                size_t k, rest = code;
+                for (k=0; k<len; ++k, rest /= 3)
+                {
+                    string[k] = alphabet[rest % 3];
+                }
+
+                search_check(&dfa, string, len);
+            }
+        }
+
+        dfa_destroy(&dfa);
+    }
+
+    // NEAR MISSES: every position starts a match that fails only at the end of the buffer
+    static char near_miss[1 << 20];
+    memset(near_miss, 'a', sizeof(near_miss));
+
+    dfa_t dfa;
+    search_dfa(&dfa, "a*b");
+    search_count_t count = {0};
+    assert(dfa_search(&dfa, near_miss, sizeof(near_miss), search_counter, &count) == OK);
+    assert(count.len == 0);
+
+    near_miss[sizeof(near_miss) - 1] = 'b';
+    assert(dfa_search(&dfa, near_miss, sizeof(near_miss), search_counter, &count) == OK);
+    assert(count.len == 1 && count.start == 0 && count.end == sizeof(near_miss));
+    dfa_destroy(&dfa);
+
+    // the matches of single characters wait for a longer match that never comes
+    search_dfa(&dfa, "a+aa*b");
+    near_miss[sizeof(near_miss) - 1] = 'a';
+    count.len = 0;
+    assert(dfa_search(&dfa, near_miss, sizeof(near_miss), search_counter, &count) == OK);
+    assert(count.len == sizeof(near_miss) && count.end == sizeof(near_miss));
+
+    near_miss[sizeof(near_miss) - 1] = 'b';
+    count.len = 0;
+    assert(dfa_search(&dfa, near_miss, sizeof(near_miss), search_counter, &count) == OK);
+    assert(count.len == 1 && count.start == 0 && count.end == sizeof(near_miss));
+    dfa_destroy(&dfa);
+
+    dfa_destroy(&tagged);
+    nfa_destroy(&merged);
+}
+
+void test_lazy_dfa()
+{
+    size_t i;
+    for (i=0; i<REGEXBUFFER_LEN; ++i)
+    {
+        lazy_dfa_t lazy;
+        assert(lazy_dfa_init(&lazy, &nfa_collection[i], 0) == OK);
+
+        // twice: the second time on the cached states
+        size_t k;
+        for (k=0; k<2; ++k)
+        {
+            size_t j;
+            for (j=0; j<sizeof(strings) / sizeof(strings[0]); ++j)
+            {
+                bool nfa_result = false;
+                bool lazy_result = true;
+
+                assert(nfa_accepts(&nfa_collection[i], strings[j], &nfa_result) == OK);
+                assert(lazy_dfa_accepts(&lazy, strings[j], &lazy_result) == OK);
+                assert(nfa_result == lazy_result);
+            }
+        }
+
+        assert(lazy.subset.sets_len <= dfa_collection[i].states_len);
+        assert(lazy.flushes == 0);
+
+        lazy_dfa_destroy(&lazy);
+        assert(lazy.table == NULL);
+    }
+
+    // a cache too small for the third to last symbol regex thrashes and falls back to the NFA
+    lazy_dfa_t lazy;
+    assert(lazy_dfa_init(&lazy, &nfa_collection[REGEXBUFFER_LEN-1], 1) == OK);
+    assert(lazy.states_max == LAZY_DFA_MIN_STATES);
+
+    char string[64];
+    unsigned int bits;
+    for (bits=0; bits<1024; ++bits)
+    {
+        unsigned int k;
+        for (k=0; k<sizeof(string)-1; ++k)
+        {
+            string[k] = ((bits * 2654435761u) >> (k % 32) & 1) ? 'b' : 'a';
+        }
+        string[sizeof(string)-1] = '\0';
+
+        bool nfa_result = false;
+        bool lazy_result = true;
+
+        assert(nfa_accepts(&nfa_collection[REGEXBUFFER_LEN-1], string, &nfa_result) == OK);
+        assert(lazy_dfa_accepts(&lazy, string, &lazy_result) == OK);
+        assert(nfa_result == lazy_result);
+    }
+
+    assert(lazy.flushes > 0);
+    assert(lazy.fallbacks > 0);
+    lazy_dfa_destroy(&lazy);
+}
+
+void test_dfa_destroy()
+{
+    size_t i;
+    for (i=0; i<REGEXBUFFER_LEN; ++i)
+    {
+        dfa_destroy(&dfa_collection[i]);
+
+        assert(dfa_collection[i].states_len == 0);
+        assert(dfa_collection[i].table == NULL);
+        assert(dfa_collection[i].final == NULL);
+    }
+}
+
+int main()
+{
+    printf("[*] Setting up...\n");
+    setup();
+
+    printf("[*] Test dfa_from_nfa:\n");
+    test_dfa_from_nfa();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test dfa_accepts:\n");
+    test_dfa_accepts();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test dfa_minimize:\n");
+    test_dfa_minimize();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test dfa_compress:\n");
+    test_dfa_compress();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test dfa_classify:\n");
+    test_dfa_classify();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test dfa_classify_batch:\n");
+    test_dfa_classify_batch();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test dfa_search:\n");
+    test_dfa_search();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test lazy_dfa_accepts:\n");
+    test_lazy_dfa();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test dfa_accepts against the compacted NFAs:\n");
+    size_t i;
+    for (i=0; i<REGEXBUFFER_LEN; ++i)
+    {
+        assert(nfa_compact(&nfa_collection[i]) == OK);
+    }
+    test_dfa_accepts();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Test dfa_destroy:\n");
+    test_dfa_destroy();
+    printf("[+] Test Successful\n");
+
+    printf("[*] Cleaning up...\n");
+    teardown();
+
+    return 0;
+}